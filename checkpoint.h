@@ -0,0 +1,133 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+constexpr int __checkpoint_interval = 1 << 16; // rounds
+
+struct MatchState {
+	uint64_t seed;
+	int iter_limit;
+	int round;
+	int first_score;
+	int second_score;
+};
+
+// Judge-side state of one long match, kept in its own directory:
+//   state    "seed iter_limit round first_score second_score", then both commands
+//   history  one (first, second) byte pair per round, appended as rounds finish
+// The state file is replaced atomically after the history is flushed, so the
+// history may only run ahead of it, and load() trims it back.
+template<class Choice>
+class MatchCheckpoint {
+	const std::filesystem::path directory;
+	std::ofstream history;
+	int written = 0;
+
+	std::filesystem::path state_path() const {
+		return directory / "state";
+	}
+
+	std::filesystem::path history_path() const {
+		return directory / "history";
+	}
+
+	void write_state(const MatchState& state, const std::string& first_command, const std::string& second_command) const {
+		const auto temporary_path = directory / "state.tmp";
+		{
+			std::ofstream state_file(temporary_path, std::ios::trunc);
+			state_file << state.seed << ' ' << state.iter_limit << ' ' << state.round << ' ';
+			state_file << state.first_score << ' ' << state.second_score << '\n';
+			state_file << first_command << '\n' << second_command << '\n';
+			if (state_file.fail()) {
+				throw std::runtime_error("Failed to write checkpoint: " + temporary_path.string());
+			}
+		}
+		std::filesystem::rename(temporary_path, state_path());
+	}
+
+public:
+	MatchCheckpoint(const std::filesystem::path& _directory): directory(_directory) {}
+
+	// Restores a checkpoint of the same pairing into `first_choices` and
+	// `second_choices` (resized to iter_limit).
+	std::optional<MatchState> load(
+		const std::string& first_command,
+		const std::string& second_command,
+		std::vector<Choice>& first_choices,
+		std::vector<Choice>& second_choices
+	) {
+		std::ifstream state_file(state_path());
+		MatchState state;
+		std::string saved_first_command, saved_second_command;
+		state_file >> state.seed >> state.iter_limit >> state.round >> state.first_score >> state.second_score;
+		state_file.ignore();
+		std::getline(state_file, saved_first_command);
+		std::getline(state_file, saved_second_command);
+		if (state_file.fail() || saved_first_command != first_command || saved_second_command != second_command) {
+			return std::nullopt;
+		}
+		if (!(0 <= state.round && state.round <= state.iter_limit)) {
+			return std::nullopt;
+		}
+
+		std::error_code error;
+		if (std::filesystem::file_size(history_path(), error) < 2 * (uintmax_t)state.round || error) {
+			return std::nullopt;
+		}
+		std::filesystem::resize_file(history_path(), 2 * (uintmax_t)state.round);
+
+		std::vector<int8_t> rounds(2 * state.round);
+		std::ifstream history_file(history_path(), std::ios::binary);
+		history_file.read((char*)rounds.data(), rounds.size());
+		if (history_file.fail()) {
+			return std::nullopt;
+		}
+
+		first_choices.resize(state.iter_limit);
+		second_choices.resize(state.iter_limit);
+		for (int round = 0; round < state.round; round++) {
+			first_choices[round] = rounds[2 * round];
+			second_choices[round] = rounds[2 * round + 1];
+		}
+
+		history.open(history_path(), std::ios::binary | std::ios::app);
+		written = state.round;
+		return state;
+	}
+
+	void begin(const MatchState& state, const std::string& first_command, const std::string& second_command) {
+		std::filesystem::create_directories(directory);
+		history.close();
+		history.open(history_path(), std::ios::binary | std::ios::trunc);
+		written = 0;
+		write_state(state, first_command, second_command);
+	}
+
+	void save(
+		const MatchState& state,
+		const std::vector<Choice>& first_choices,
+		const std::vector<Choice>& second_choices,
+		const std::string& first_command,
+		const std::string& second_command
+	) {
+		for (; written < state.round; written++) {
+			history.put((char)first_choices[written]);
+			history.put((char)second_choices[written]);
+		}
+		history.flush();
+		if (history.fail()) {
+			throw std::runtime_error("Failed to write checkpoint: " + history_path().string());
+		}
+		write_state(state, first_command, second_command);
+	}
+
+	void clear() {
+		history.close();
+		std::filesystem::remove_all(directory);
+	}
+};
@@ -1,3 +1,4 @@
+#pragma once
 #include <filesystem>
 #include <map>
 #include <string>
@@ -74,7 +75,7 @@ const std::map<std::string, CompileOptions> compile_options = {
 					"py_compile.compile("
 					"r'" + input_path.string() + "'" +
 					", optimize=2"
-					", cfile=" + output_path.string() + 
+					", cfile=r'" + output_path.string() + "'" +
 					")\""
 				);
 			},
@@ -99,7 +100,7 @@ const std::map<std::string, CompileOptions> compile_options = {
 					"py_compile.compile("
 					"r'" + input_path.string() + "'" +
 					", optimize=2"
-					", cfile=" + output_path.string() + 
+					", cfile=r'" + output_path.string() + "'" +
 					")\""
 				);
 			},
@@ -113,12 +114,16 @@ const std::map<std::string, CompileOptions> compile_options = {
 		"java",
 		{
 			"a.java",
-			"a",
+			"a.class",
 			[](
 				const std::filesystem::path& input_path,
 				const std::filesystem::path& output_path
 			) {
-				return "javac -J-Xms1024m -J-Xmx1024m -J-Xss512m -encoding UTF-8 " + input_path.string();
+				// JavaHost.input()/output() resolve against the host source.
+				return (
+					"javac -J-Xms1024m -J-Xmx1024m -J-Xss512m -encoding UTF-8"
+					" -implicit:none -sourcepath hosts " + input_path.string()
+				);
 			},
 			[](const std::filesystem::path& output_path) {
 				return "java -Xms1024m -Xmx1024m -Xss512m -Dfile.encoding=UTF-8 " + output_path.string();
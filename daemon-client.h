@@ -0,0 +1,173 @@
+#pragma once
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "daemon-protocol.h"
+
+// Blocking client for JudgeDaemon. It stands in for the real frontend in
+// local testing: each call submits one job and reads frames until its
+// result, an error, or a busy rejection arrives.
+class DaemonClient {
+	int fd = -1;
+	uint32_t next_tag = 1;
+
+public:
+	using ProgressCallback = std::function<void(uint32_t done, uint32_t total)>;
+
+	uint32_t last_job_id = 0;
+
+	DaemonClient(const std::filesystem::path& socket_path) {
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0) {
+			throw std::runtime_error("Failed to create socket!");
+		}
+
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if (socket_path.string().size() >= sizeof(address.sun_path)) {
+			throw std::runtime_error("Socket path too long!");
+		}
+		strcpy(address.sun_path, socket_path.c_str());
+		if (connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+			::close(fd);
+			throw std::runtime_error("Failed to connect to " + socket_path.string());
+		}
+	}
+
+	DaemonClient(const DaemonClient&) = delete;
+	DaemonClient& operator=(const DaemonClient&) = delete;
+
+	~DaemonClient() {
+		::close(fd);
+	}
+
+	// Returns the result frame, or an error/busy frame as-is.
+	Frame request(
+		const FrameType type,
+		const std::string& payload,
+		const Priority priority = Priority::normal,
+		const ProgressCallback& on_progress = nullptr
+	) {
+		const auto tag = next_tag++;
+		if (!write_frame(fd, type, tag, payload, priority)) {
+			throw std::runtime_error("Failed to send request!");
+		}
+
+		Frame frame;
+		for (;;) {
+			if (!read_frame(fd, frame)) {
+				throw std::runtime_error("Daemon closed the connection!");
+			}
+			if (frame.header.job_id != tag) {
+				continue;
+			}
+			if (frame.header.type == FrameType::accepted) {
+				last_job_id = FrameReader(frame.payload).get<uint32_t>();
+			}
+			else if (frame.header.type == FrameType::progress) {
+				if (on_progress) {
+					FrameReader reader(frame.payload);
+					const auto done = reader.get<uint32_t>();
+					on_progress(done, reader.get<uint32_t>());
+				}
+			}
+			else {
+				return frame;
+			}
+		}
+	}
+
+	static void check(const Frame& frame) {
+		if (frame.header.type == FrameType::busy) {
+			throw std::runtime_error("Daemon is busy!");
+		}
+		if (frame.header.type == FrameType::error) {
+			throw std::runtime_error(FrameReader(frame.payload).get_string());
+		}
+	}
+
+	std::optional<std::string> compile(
+		const std::string& strategy_name,
+		const std::string& lang,
+		const std::string& content,
+		const Priority priority = Priority::interactive
+	) {
+		const auto frame = request(
+			FrameType::compile,
+			FrameWriter().put(strategy_name).put(lang).put(content).payload,
+			priority
+		);
+		check(frame);
+
+		FrameReader reader(frame.payload);
+		const bool ok = reader.get<uint8_t>();
+		const auto command = reader.get_string();
+		if (!ok) {
+			return std::nullopt;
+		}
+		return command;
+	}
+
+	// Strategies are named as they were compiled.
+	std::optional<std::pair<int, int>> match(
+		const std::string& first_name,
+		const std::string& second_name,
+		const std::pair<int, int> iter_range = {200, 500},
+		const Priority priority = Priority::interactive
+	) {
+		const auto frame = request(
+			FrameType::match,
+			FrameWriter().put(first_name).put(second_name)
+				.put<int32_t>(iter_range.first).put<int32_t>(iter_range.second).payload,
+			priority
+		);
+		check(frame);
+
+		FrameReader reader(frame.payload);
+		const bool ok = reader.get<uint8_t>();
+		const auto first_score = reader.get<int32_t>();
+		const auto second_score = reader.get<int32_t>();
+		if (!ok) {
+			return std::nullopt;
+		}
+		return std::pair{first_score, second_score};
+	}
+
+	// Latency report of the daemon's judge; see LatencyProfiler::report.
+	std::string report(const Priority priority = Priority::interactive) {
+		const auto frame = request(FrameType::report, "", priority);
+		check(frame);
+		return FrameReader(frame.payload).get_string();
+	}
+
+	// Returns (score, failed matches) per strategy name, in order.
+	std::vector<std::pair<long long, uint32_t>> tournament(
+		const std::vector<std::string>& names,
+		const std::pair<int, int> iter_range = {200, 500},
+		const Priority priority = Priority::bulk,
+		const ProgressCallback& on_progress = nullptr
+	) {
+		FrameWriter writer;
+		writer.put<int32_t>(iter_range.first).put<int32_t>(iter_range.second).put<uint32_t>(names.size());
+		for (const auto& name : names) {
+			writer.put(name);
+		}
+
+		const auto frame = request(FrameType::tournament, writer.payload, priority, on_progress);
+		check(frame);
+
+		FrameReader reader(frame.payload);
+		std::vector<std::pair<long long, uint32_t>> standings(reader.get<uint32_t>());
+		for (auto& [score, failures] : standings) {
+			score = reader.get<int64_t>();
+			failures = reader.get<uint32_t>();
+		}
+		return standings;
+	}
+};
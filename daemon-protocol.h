@@ -0,0 +1,165 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Binary framing between the judge daemon and its clients, over a unix socket.
+// Every frame is a FrameHeader followed by `size` bytes of payload, in host
+// byte order since both ends live on the same machine. A request carries a
+// client-chosen tag in job_id, and every frame answering it echoes the tag.
+//
+//   compile    str name, str lang, str content
+//   match      str first, str second, i32 iter_min, i32 iter_max
+//   tournament i32 iter_min, i32 iter_max, u32 count, str name * count
+//
+// Matches and tournaments name strategies compiled earlier on the daemon.
+//   fetch      u32 daemon job id
+//   report     (empty)
+//
+//   accepted   u32 daemon job id
+//   busy       u32 queued jobs at the requested priority
+//   progress   u32 done, u32 total
+//   result     compile:    u8 ok, str command
+//              match:      u8 ok, i32 first_score, i32 second_score
+//              tournament: u32 count, (i64 score, u32 failures) * count
+//              report:     str latency report
+//   error      str message
+
+constexpr uint32_t __max_frame_size = 1 << 24;
+
+enum class FrameType : uint16_t {
+	compile = 1,
+	match = 2,
+	tournament = 3,
+	fetch = 4,
+	report = 5,
+
+	accepted = 16,
+	busy = 17,
+	progress = 18,
+	result = 19,
+	error = 20
+};
+
+enum class Priority : uint8_t {
+	interactive = 0,
+	normal = 1,
+	bulk = 2
+};
+
+constexpr int __priority_count = 3;
+
+struct FrameHeader {
+	uint32_t size;
+	FrameType type;
+	Priority priority;
+	uint8_t reserved;
+	uint32_t job_id;
+};
+
+static_assert(sizeof(FrameHeader) == 12);
+
+struct Frame {
+	FrameHeader header;
+	std::string payload;
+};
+
+class FrameWriter {
+public:
+	std::string payload;
+
+	template<class Integer>
+	FrameWriter& put(const Integer value) {
+		payload.append(reinterpret_cast<const char*>(&value), sizeof(value));
+		return *this;
+	}
+
+	FrameWriter& put(const std::string& value) {
+		put<uint32_t>(value.size());
+		payload.append(value);
+		return *this;
+	}
+};
+
+class FrameReader {
+	const std::string& payload;
+	size_t position = 0;
+
+	void require(const size_t size) {
+		if (payload.size() - position < size) {
+			throw std::runtime_error("Truncated frame!");
+		}
+	}
+
+public:
+	FrameReader(const std::string& _payload): payload(_payload) {}
+
+	template<class Integer>
+	Integer get() {
+		Integer value;
+		require(sizeof(value));
+		memcpy(&value, payload.data() + position, sizeof(value));
+		position += sizeof(value);
+		return value;
+	}
+
+	std::string get_string() {
+		const auto size = get<uint32_t>();
+		require(size);
+		position += size;
+		return payload.substr(position - size, size);
+	}
+};
+
+inline bool write_all(const int fd, const char* data, size_t size) {
+	while (size > 0) {
+		const auto written = send(fd, data, size, MSG_NOSIGNAL);
+		if (written <= 0) {
+			return false;
+		}
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+inline bool read_all(const int fd, char* data, size_t size) {
+	while (size > 0) {
+		const auto read_bytes = recv(fd, data, size, 0);
+		if (read_bytes <= 0) {
+			return false;
+		}
+		data += read_bytes;
+		size -= read_bytes;
+	}
+	return true;
+}
+
+inline bool write_frame(
+	const int fd,
+	const FrameType type,
+	const uint32_t job_id,
+	const std::string& payload = "",
+	const Priority priority = Priority::normal
+) {
+	const FrameHeader header = { (uint32_t)payload.size(), type, priority, 0, job_id };
+	std::string frame(reinterpret_cast<const char*>(&header), sizeof(header));
+	frame += payload;
+	return write_all(fd, frame.data(), frame.size());
+}
+
+// Returns false on a closed connection or an oversized frame.
+inline bool read_frame(const int fd, Frame& frame) {
+	if (!read_all(fd, reinterpret_cast<char*>(&frame.header), sizeof(frame.header))) {
+		return false;
+	}
+	if (frame.header.size > __max_frame_size) {
+		return false;
+	}
+	frame.payload.resize(frame.header.size);
+	return read_all(fd, frame.payload.data(), frame.payload.size());
+}
@@ -0,0 +1,135 @@
+// Long-lived host for java strategies (see interpreter-host.h).
+// Reads "<path/a.class> <shmid>" per match from stdin, loads the strategy
+// through a fresh class loader so that static state is reset, and answers
+// "ok" or "error" on the original stdout. Needs the FFM API (Java 22+).
+import java.io.BufferedReader;
+import java.io.InputStreamReader;
+import java.io.PrintStream;
+import java.lang.foreign.FunctionDescriptor;
+import java.lang.foreign.Linker;
+import java.lang.foreign.MemorySegment;
+import java.lang.foreign.ValueLayout;
+import java.lang.invoke.MethodHandle;
+import java.lang.invoke.VarHandle;
+import java.lang.reflect.InvocationTargetException;
+import java.lang.reflect.Method;
+import java.net.URL;
+import java.net.URLClassLoader;
+import java.nio.file.Path;
+
+public class JavaHost {
+	// Must match SharedData in sandboxed-process.h.
+	private static final int CHANNEL_MAGIC = 0x43445049;
+	private static final int CHANNEL_LAYOUT_VERSION = 3;
+	private static final int LOST_HANDOFF = -2;
+	private static final long MAGIC = 0;
+	private static final long LAYOUT_VERSION = 4;
+	private static final long SIZE = 8;
+	private static final long HARNESS_FEATURES = 16; // no replay support: resumed matches restart
+	private static final long HARNESS_ACK = 32;
+	private static final long TO_STRATEGY_SEQUENCE = 64;
+	private static final long TO_STRATEGY_VALUE = 68;
+	private static final long TO_JUDGE_SEQUENCE = 128;
+	private static final long TO_JUDGE_VALUE = 132;
+	private static final long SHARED_DATA_SIZE = 192;
+
+	private static final VarHandle INT = ValueLayout.JAVA_INT.varHandle();
+	private static final MethodHandle shmat;
+	private static final MethodHandle shmdt;
+	private static MemorySegment data;
+	private static int received;
+	private static int sent;
+
+	static {
+		final Linker linker = Linker.nativeLinker();
+		shmat = linker.downcallHandle(
+			linker.defaultLookup().find("shmat").orElseThrow(),
+			FunctionDescriptor.of(ValueLayout.ADDRESS, ValueLayout.JAVA_INT, ValueLayout.ADDRESS, ValueLayout.JAVA_INT)
+		);
+		shmdt = linker.downcallHandle(
+			linker.defaultLookup().find("shmdt").orElseThrow(),
+			FunctionDescriptor.of(ValueLayout.JAVA_INT, ValueLayout.ADDRESS)
+		);
+	}
+
+	public static int input() {
+		int sequence;
+		while ((sequence = (int) INT.getAcquire(data, TO_STRATEGY_SEQUENCE)) == received) {
+			Thread.onSpinWait();
+		}
+		if (sequence != received + 1) {
+			return LOST_HANDOFF;
+		}
+		received = sequence;
+		return (int) INT.get(data, TO_STRATEGY_VALUE);
+	}
+
+	public static void output(final int value) {
+		INT.set(data, TO_JUDGE_VALUE, value);
+		INT.setRelease(data, TO_JUDGE_SEQUENCE, ++sent);
+	}
+
+	private static void run(final Path module) throws Exception {
+		final String className = module.getFileName().toString().replaceFirst("\\.class$", "");
+		final URL[] classPath = { module.getParent().toUri().toURL() };
+		try (URLClassLoader loader = new URLClassLoader(classPath, JavaHost.class.getClassLoader())) {
+			final Class<?> strategy = loader.loadClass(className);
+			if (!handshake()) {
+				throw new IllegalStateException("Channel layout mismatch");
+			}
+			try {
+				final Method entry = strategy.getMethod("__main__");
+				entry.invoke(null);
+			} catch (NoSuchMethodException e) {
+				strategy.getMethod("main", String[].class).invoke(null, (Object) new String[0]);
+			}
+		}
+	}
+
+	// Acknowledges the channel layout once the strategy is loaded.
+	private static boolean handshake() {
+		final boolean valid = (
+			(int) INT.get(data, MAGIC) == CHANNEL_MAGIC &&
+			(int) INT.get(data, LAYOUT_VERSION) == CHANNEL_LAYOUT_VERSION &&
+			(int) INT.get(data, SIZE) == (int) SHARED_DATA_SIZE
+		);
+		INT.set(data, HARNESS_FEATURES, 0);
+		INT.setRelease(data, HARNESS_ACK, CHANNEL_MAGIC ^ CHANNEL_LAYOUT_VERSION);
+		return valid;
+	}
+
+	public static void main(String[] args) throws Throwable {
+		final PrintStream control = System.out;
+		System.setOut(System.err); // strategies must not write to the control socket
+
+		final BufferedReader requests = new BufferedReader(new InputStreamReader(System.in));
+		for (String line; (line = requests.readLine()) != null; ) {
+			final String[] request = line.trim().split(" ");
+			final MemorySegment addr = (MemorySegment) shmat.invokeExact(Integer.parseInt(request[1]), MemorySegment.NULL, 0);
+			if (addr.address() == -1L) {
+				control.print("error\n");
+				control.flush();
+				continue;
+			}
+
+			String status = "ok";
+			data = addr.reinterpret(SHARED_DATA_SIZE);
+			received = 0;
+			sent = 0;
+			try {
+				run(Path.of(request[0]));
+			} catch (InvocationTargetException e) {
+				e.getCause().printStackTrace();
+				status = "error";
+			} catch (Exception e) {
+				e.printStackTrace();
+				status = "error";
+			}
+
+			final int detached = (int) shmdt.invokeExact(addr);
+			data = null;
+			control.print(status + "\n");
+			control.flush();
+		}
+	}
+}
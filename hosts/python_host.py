@@ -0,0 +1,158 @@
+# Long-lived host for python/pypy strategies (see interpreter-host.h).
+# Reads "<module.pyc> <shmid>" per match from stdin, runs the strategy in a
+# fresh namespace, and answers "ok" or "error" on the original stdout.
+import ctypes
+import importlib.util
+import marshal
+import os
+import sys
+import traceback
+
+# Must match SharedData in sandboxed-process.h.
+CHANNEL_MAGIC = 0x43445049
+CHANNEL_LAYOUT_VERSION = 3
+LOST_HANDOFF = -2
+HARNESS_FEATURE_REPLAY = 1
+REPLAY_DONE = 1
+REPLAY_DIVERGED = 2
+
+class ChannelSlot(ctypes.Structure):
+	_fields_ = [
+		("sequence", ctypes.c_uint32),
+		("value", ctypes.c_int32),
+		("padding", ctypes.c_char * 56),
+	]
+
+class SharedData(ctypes.Structure):
+	_fields_ = [
+		("magic", ctypes.c_uint32),
+		("layout_version", ctypes.c_uint32),
+		("size", ctypes.c_uint32),
+		("reserved", ctypes.c_uint32),
+		("harness_features", ctypes.c_uint32),
+		("replay_shmid", ctypes.c_int32),
+		("replay_rounds", ctypes.c_uint32),
+		("replay_status", ctypes.c_uint32),
+		("harness_ack", ctypes.c_uint32),
+		("padding", ctypes.c_char * 28),
+		("to_strategy", ChannelSlot),
+		("to_judge", ChannelSlot),
+	]
+
+libc = ctypes.CDLL(None, use_errno=True)
+libc.shmat.restype = ctypes.c_void_p
+libc.shmat.argtypes = [ctypes.c_int, ctypes.c_void_p, ctypes.c_int]
+libc.shmdt.argtypes = [ctypes.c_void_p]
+
+SHM_RDONLY = 0o10000
+
+codes = {}
+
+def load(module):
+	mtime = os.stat(module).st_mtime_ns
+	cached = codes.get(module)
+	if cached is None or cached[0] != mtime:
+		with open(module, "rb") as module_file:
+			data = module_file.read()
+		if data[:4] == importlib.util.MAGIC_NUMBER:
+			cached = (mtime, marshal.loads(data[16:]))
+		else:
+			# e.g. pypy3 running a CPython pyc: fall back to the source next to it
+			source = os.path.splitext(module)[0] + ".py"
+			with open(source) as source_file:
+				cached = (mtime, compile(source_file.read(), source, "exec", optimize=2))
+		codes[module] = cached
+	return cached[1]
+
+def run(code, data, replay):
+	to_strategy = data.to_strategy
+	to_judge = data.to_judge
+	received = 0
+	sent = 0
+	replay_rounds = len(replay) // 2
+	replay_round = 0
+	replay_diverged = False
+
+	def input():
+		nonlocal received, replay_round
+		if replay_round < replay_rounds:
+			replay_round += 1
+			return replay[replay_rounds + replay_round - 1]
+		while to_strategy.sequence == received:
+			pass
+		sequence = to_strategy.sequence
+		if sequence != received + 1:
+			return LOST_HANDOFF
+		received = sequence
+		return to_strategy.value
+
+	def output(value):
+		nonlocal sent, replay_diverged
+		if replay_round < replay_rounds:
+			replay_diverged |= value != replay[replay_round]
+			return
+		if replay_rounds and sent == 0:
+			data.replay_status = REPLAY_DIVERGED if replay_diverged else REPLAY_DONE
+		sent += 1
+		to_judge.value = value
+		to_judge.sequence = sent
+
+	namespace = {"__name__": "__strategy__", "input": input, "output": output}
+	exec(code, namespace)
+	if "__main__" in namespace:
+		namespace["__main__"]()
+
+def main():
+	control = os.fdopen(os.dup(1), "w")
+	os.dup2(2, 1) # strategies must not write to the control socket
+
+	for line in sys.stdin:
+		module, shmid = line.split()
+		addr = libc.shmat(int(shmid), None, 0)
+		if addr is None or addr == ctypes.c_void_p(-1).value:
+			control.write("error\n")
+			control.flush()
+			continue
+
+		try:
+			code = load(module)
+		except Exception:
+			traceback.print_exc()
+			libc.shmdt(addr)
+			control.write("error\n")
+			control.flush()
+			continue
+
+		data = SharedData.from_address(addr)
+		valid = (
+			data.magic == CHANNEL_MAGIC and
+			data.layout_version == CHANNEL_LAYOUT_VERSION and
+			data.size == ctypes.sizeof(SharedData)
+		)
+
+		replay = b""
+		if valid and data.replay_rounds > 0:
+			replay_addr = libc.shmat(data.replay_shmid, None, SHM_RDONLY)
+			if replay_addr is None or replay_addr == ctypes.c_void_p(-1).value:
+				valid = False
+			else:
+				replay = ctypes.string_at(replay_addr, 2 * data.replay_rounds)
+				libc.shmdt(replay_addr)
+		data.harness_features = HARNESS_FEATURE_REPLAY
+		data.harness_ack = CHANNEL_MAGIC ^ CHANNEL_LAYOUT_VERSION
+
+		status = "ok" if valid else "error"
+		try:
+			if valid:
+				run(code, data, replay)
+		except SystemExit:
+			pass
+		except Exception:
+			traceback.print_exc()
+			status = "error"
+
+		libc.shmdt(addr)
+		control.write(status + "\n")
+		control.flush()
+
+main()
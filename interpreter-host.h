@@ -0,0 +1,269 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <tuple>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <signal.h>
+#include <wait.h>
+#include <poll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "placement.h"
+#include "sandbox-manager.h"
+
+constexpr int __host_match_budget = 256;
+constexpr int __host_finish_timeout = 1000; // ms
+
+// Long-lived language hosts, keyed by the runtime word of an execution command.
+// A host loads the compiled module, runs one match against the given shmid,
+// and answers "ok" or "error" on its control socket.
+const std::map<std::string, std::vector<std::string>> interpreter_host_commands = {
+	{"python3", {"python3", "hosts/python_host.py"}},
+	{"pypy3", {"pypy3", "hosts/python_host.py"}},
+	{
+		"java",
+		{
+			"java", "-Xms1024m", "-Xmx1024m", "-Xss512m", "-Dfile.encoding=UTF-8",
+			"--enable-native-access=ALL-UNNAMED", "hosts/JavaHost.java"
+		}
+	}
+};
+
+// Splits "python3 /path/a.pyc" into {"python3", "/path/a.pyc"}.
+// The runtime is the first word and the module is the last one.
+inline std::pair<std::string, std::string> split_execution_command(const std::string& command) {
+	const auto first_space = command.find(' ');
+	if (first_space == std::string::npos) {
+		return {command, ""};
+	}
+	return {command.substr(0, first_space), command.substr(command.rfind(' ') + 1)};
+}
+
+// An execution command split once up front, so that starting a match
+// neither parses nor copies it.
+struct ExecCommand {
+	std::string command;
+	std::string runtime;
+	std::string module;
+
+	ExecCommand(const std::string& _command): command(_command) {
+		std::tie(runtime, module) = split_execution_command(command);
+	}
+
+	ExecCommand(const char* _command): ExecCommand(std::string(_command)) {}
+};
+
+// A host started in a SandboxManager runs in a slot of its own, and may only
+// attach the segments of the match it is in (see allow_attachments()).
+class InterpreterHost {
+	const std::vector<std::string> argv;
+	SandboxManager* const sandbox;
+	int sandbox_slot = -1;
+	int listener = -1;
+	int pid = -1;
+	int control = -1;
+	int matches = 0;
+	int pinned_cpu = -1;
+	int channel_shmid = -1;
+	int replay_shmid = -1;
+
+	void start() {
+		// Close-on-exec keeps other hosts' control sockets out of this one.
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+			throw std::runtime_error("Failed to socketpair!");
+		}
+
+		std::vector<char*> args;
+		for (const auto& arg : argv) {
+			args.push_back(const_cast<char*>(arg.data()));
+		}
+		args.push_back(nullptr);
+
+		if (sandbox) {
+			try {
+				if (sandbox_slot == -1) {
+					sandbox_slot = sandbox->add_host_slot();
+				}
+				pid = sandbox->spawn_host(sandbox_slot, args.data(), fds[1], listener);
+			} catch (...) {
+				::close(fds[0]);
+				::close(fds[1]);
+				throw;
+			}
+		}
+		else {
+			pid = fork();
+			if (pid == 0) {
+				prctl(PR_SET_PDEATHSIG, SIGKILL);
+				dup2(fds[1], 0);
+				dup2(fds[1], 1);
+				execvp(args[0], args.data());
+				exit(-1); // execvp failed
+			}
+			else if (pid < 0) {
+				::close(fds[0]);
+				::close(fds[1]);
+				throw std::runtime_error("Failed to fork!");
+			}
+		}
+
+		::close(fds[1]);
+		control = fds[0];
+		matches = 0;
+		pin_process_to_cpu(pid, -1); // not the judge's cpu it was forked on
+		pinned_cpu = -1;
+	}
+
+	bool alive() {
+		if (pid > 0 && waitpid(pid, nullptr, WNOHANG) != 0) {
+			pid = -1; // already reaped
+		}
+		return pid > 0;
+	}
+
+public:
+	bool busy = false;
+
+	InterpreterHost(const std::vector<std::string>& _argv, SandboxManager* _sandbox = nullptr):
+		argv(_argv), sandbox(_sandbox) {}
+	InterpreterHost(const InterpreterHost&) = delete;
+	InterpreterHost& operator=(const InterpreterHost&) = delete;
+
+	~InterpreterHost() {
+		stop();
+	}
+
+	void stop() {
+		if (pid > 0) {
+			kill(pid, SIGKILL);
+			waitpid(pid, nullptr, 0);
+		}
+		if (control >= 0) {
+			::close(control);
+		}
+		if (listener >= 0) {
+			::close(listener);
+		}
+		if (sandbox_slot != -1) {
+			sandbox->clear_slot(sandbox_slot);
+		}
+		pid = -1;
+		control = -1;
+		listener = -1;
+	}
+
+	// True while the host is still inside the current match. A sandboxed
+	// host's pending shmat() calls are answered on the way, since the judge
+	// checks this while it waits for the host anyway.
+	bool running() {
+		allow_attachments();
+		pollfd fd = { control, POLLIN, 0 };
+		return alive() && poll(&fd, 1, 0) == 0;
+	}
+
+	int get_pid() const {
+		return pid;
+	}
+
+	// Pins all of the host's threads to `cpu` (-1: anywhere), e.g. the JVM
+	// runs main on another thread. A reused host is only re-pinned when its
+	// cpu changes.
+	void pin(const int cpu) {
+		if (cpu != pinned_cpu) {
+			pin_process_to_cpu(pid, cpu);
+			pinned_cpu = cpu;
+		}
+	}
+
+	// Lets a sandboxed host attach the segments given to begin(), and
+	// refuses any other.
+	void allow_attachments() {
+		if (listener >= 0) {
+			SandboxManager::allow_attachments(listener, channel_shmid, replay_shmid);
+		}
+	}
+
+	void begin(const std::string& module, const int shmid, const int replay = -1) {
+		channel_shmid = shmid;
+		replay_shmid = replay;
+
+		char suffix[16];
+		const int suffix_size = snprintf(suffix, sizeof(suffix), " %d\n", shmid);
+		iovec request[2] = {
+			{ const_cast<char*>(module.data()), module.size() },
+			{ suffix, (size_t)suffix_size }
+		};
+		msghdr message = {};
+		message.msg_iov = request;
+		message.msg_iovlen = 2;
+
+		for (int attempt = 0; attempt < 2; attempt++) {
+			if (!alive()) {
+				stop();
+				start();
+			}
+			if (sendmsg(control, &message, MSG_NOSIGNAL) == (ssize_t)(module.size() + suffix_size)) {
+				return;
+			}
+			stop();
+		}
+		throw std::runtime_error("Failed to reach interpreter host!");
+	}
+
+	// Waits for the host to report the end of a match. The host is recycled
+	// after a crash, a timeout, or once it has served its match budget.
+	bool finish() {
+		pollfd fd = { control, POLLIN, 0 };
+		char reply[8] = {};
+		bool ok = false;
+		if (poll(&fd, 1, __host_finish_timeout) == 1) {
+			const auto read_bytes = recv(control, reply, sizeof(reply) - 1, 0);
+			ok = read_bytes == 3 && memcmp(reply, "ok\n", 3) == 0;
+		}
+
+		if (!ok || ++matches >= __host_match_budget) {
+			stop();
+		}
+		return ok;
+	}
+};
+
+class InterpreterHostPool {
+	std::map<std::string, std::vector<std::unique_ptr<InterpreterHost>>> hosts;
+	SandboxManager* sandbox = nullptr;
+
+public:
+	// Starts hosts in `sandbox` from now on, after stopping the current ones.
+	void use_sandbox(SandboxManager* _sandbox) {
+		hosts.clear();
+		sandbox = _sandbox;
+	}
+
+	// Returns an idle host for the runtime, or nullptr if it is not hosted.
+	InterpreterHost* acquire(const std::string& runtime) {
+		const auto command = interpreter_host_commands.find(runtime);
+		if (command == interpreter_host_commands.end()) {
+			return nullptr;
+		}
+
+		auto& runtime_hosts = hosts[runtime];
+		for (auto& host : runtime_hosts) {
+			if (!host->busy) {
+				host->busy = true;
+				return host.get();
+			}
+		}
+
+		runtime_hosts.push_back(std::make_unique<InterpreterHost>(command->second, sandbox));
+		runtime_hosts.back()->busy = true;
+		return runtime_hosts.back().get();
+	}
+};
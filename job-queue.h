@@ -0,0 +1,86 @@
+#pragma once
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include "daemon-protocol.h"
+
+// Bounded multi-priority queue. Lower Priority values are served first, and
+// push() refuses work once a level is at capacity so that callers can apply
+// backpressure instead of queueing without limit.
+template<class Job>
+class JobQueue {
+	std::array<std::deque<Job>, __priority_count> queues;
+	const std::array<size_t, __priority_count> capacities;
+	std::mutex mutex;
+	std::condition_variable ready;
+	bool closed = false;
+
+public:
+	JobQueue(const std::array<size_t, __priority_count>& _capacities = {64, 256, 4096}):
+		capacities(_capacities) {}
+
+	bool push(Job job, const Priority priority) {
+		{
+			std::lock_guard lock(mutex);
+			auto& queue = queues[(int)priority];
+			if (closed || queue.size() >= capacities[(int)priority]) {
+				return false;
+			}
+			queue.push_back(std::move(job));
+		}
+		ready.notify_one();
+		return true;
+	}
+
+	// Puts a preempted job back at the head of its level, ignoring capacity.
+	void push_front(Job job, const Priority priority) {
+		{
+			std::lock_guard lock(mutex);
+			queues[(int)priority].push_front(std::move(job));
+		}
+		ready.notify_one();
+	}
+
+	// Blocks until a job is available. Returns nullopt once closed.
+	std::optional<Job> pop() {
+		std::unique_lock lock(mutex);
+		for (;;) {
+			if (closed) {
+				return std::nullopt;
+			}
+			for (auto& queue : queues) {
+				if (!queue.empty()) {
+					auto job = std::move(queue.front());
+					queue.pop_front();
+					return job;
+				}
+			}
+			ready.wait(lock);
+		}
+	}
+
+	bool has_higher(const Priority priority) {
+		std::lock_guard lock(mutex);
+		for (int level = 0; level < (int)priority; level++) {
+			if (!queues[level].empty()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	size_t size(const Priority priority) {
+		std::lock_guard lock(mutex);
+		return queues[(int)priority].size();
+	}
+
+	void close() {
+		{
+			std::lock_guard lock(mutex);
+			closed = true;
+		}
+		ready.notify_all();
+	}
+};
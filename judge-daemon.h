@@ -0,0 +1,481 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "daemon-protocol.h"
+#include "job-queue.h"
+#include "judge.h"
+
+constexpr size_t __result_store_size = 4096;
+constexpr int __daemon_poll_interval = 200; // ms
+constexpr size_t __connection_outbox_limit = 4 * (size_t)__max_frame_size; // bytes
+
+// Finished job results, kept so that a client can fetch them again later.
+class ResultStore {
+	std::mutex mutex;
+	std::map<uint32_t, std::string> results;
+	std::deque<uint32_t> order;
+
+public:
+	void put(const uint32_t job_id, const std::string& payload) {
+		std::lock_guard lock(mutex);
+		if (results.emplace(job_id, payload).second) {
+			order.push_back(job_id);
+		}
+		if (order.size() > __result_store_size) {
+			results.erase(order.front());
+			order.pop_front();
+		}
+	}
+
+	std::optional<std::string> get(const uint32_t job_id) {
+		std::lock_guard lock(mutex);
+		const auto result = results.find(job_id);
+		if (result == results.end()) {
+			return std::nullopt;
+		}
+		return result->second;
+	}
+};
+
+// Long-running judge worker. One thread accepts clients, and each connection
+// gets a reader thread that queues its jobs and a writer thread. A single
+// executor thread owns the Judge, so compiled artifacts, interpreter hosts
+// and the result store stay warm across jobs.
+// Tournaments run one match per step and yield to higher-priority jobs
+// between matches.
+class JudgeDaemon {
+	// Frames for a client go through an outbox drained by the connection's
+	// own writer thread, and its own reader thread takes its requests, so a
+	// client that stalls either way only stalls itself. A client that lets
+	// its outbox grow past __connection_outbox_limit is dropped.
+	struct Connection {
+		const int fd;
+		std::mutex mutex;
+		std::condition_variable wakeup;
+		std::deque<std::string> outbox;
+		size_t outbox_size = 0;
+		bool closed = false;
+		std::atomic<int> threads_done = 0;
+
+		Connection(const int _fd): fd(_fd) {}
+		~Connection() {
+			::close(fd);
+		}
+
+		// Requires `mutex`.
+		bool enqueue(const FrameType type, const uint32_t tag, const std::string& payload = "") {
+			if (closed) {
+				return false;
+			}
+			if (outbox_size + sizeof(FrameHeader) + payload.size() > __connection_outbox_limit) {
+				close_locked();
+				return false;
+			}
+			const FrameHeader header = { (uint32_t)payload.size(), type, Priority::normal, 0, tag };
+			outbox.emplace_back(reinterpret_cast<const char*>(&header), sizeof(header));
+			outbox.back() += payload;
+			outbox_size += outbox.back().size();
+			wakeup.notify_one();
+			return true;
+		}
+
+		bool send(const FrameType type, const uint32_t tag, const std::string& payload = "") {
+			std::lock_guard lock(mutex);
+			return enqueue(type, tag, payload);
+		}
+
+		// Requires `mutex`. Unblocks both threads; the fd is closed once
+		// the last reference goes.
+		void close_locked() {
+			if (!closed) {
+				closed = true;
+				shutdown(fd, SHUT_RDWR);
+				wakeup.notify_all();
+			}
+		}
+
+		void close() {
+			std::lock_guard lock(mutex);
+			close_locked();
+		}
+
+		void write_loop() {
+			std::unique_lock lock(mutex);
+			for (;;) {
+				wakeup.wait(lock, [&]() { return closed || !outbox.empty(); });
+				if (closed) {
+					break;
+				}
+				const auto frame = std::move(outbox.front());
+				outbox.pop_front();
+				outbox_size -= frame.size();
+
+				lock.unlock();
+				const bool written = write_all(fd, frame.data(), frame.size());
+				lock.lock();
+				if (!written) {
+					close_locked();
+					break;
+				}
+			}
+			threads_done++;
+		}
+	};
+
+	struct Session {
+		std::shared_ptr<Connection> connection;
+		std::thread reader;
+		std::thread writer;
+	};
+
+	struct Job {
+		uint32_t id;
+		uint32_t tag;
+		FrameType type;
+		Priority priority;
+		std::shared_ptr<Connection> connection;
+		std::string payload;
+
+		// Tournament state, carried across steps.
+		std::vector<ExecCommand> commands = {};
+		std::pair<int, int> iter_range = {};
+		size_t next_match = 0;
+		std::vector<long long> scores = {};
+		std::vector<uint32_t> failures = {};
+	};
+
+	const std::filesystem::path socket_path;
+	const std::filesystem::path state_directory;
+	Judge<int> judge;
+	JobQueue<Job> queue;
+	ResultStore results;
+	std::map<std::string, std::pair<std::string, std::optional<std::string>>> compiled; // name -> (lang + source, command)
+	std::atomic<uint32_t> next_job_id = 1;
+	std::atomic<bool> stopping = false;
+	int listen_fd = -1;
+
+	static std::pair<size_t, size_t> tournament_pair(const size_t count, size_t match) {
+		for (size_t first = 0; first < count; first++) {
+			if (match < count - first - 1) {
+				return {first, first + 1 + match};
+			}
+			match -= count - first - 1;
+		}
+		return {count, count};
+	}
+
+	// A strategy name is used as a directory under the strategies directory,
+	// so it must be a single path component.
+	static bool valid_name(const std::string& name) {
+		return !name.empty() && name != "." && name != ".." && name.find_first_of(std::string("/\0", 2)) == std::string::npos;
+	}
+
+	// Matches only run strategies this daemon has compiled, never a command
+	// line taken from a client.
+	ExecCommand resolve(const std::string& name) const {
+		const auto cached = compiled.find(name);
+		if (cached == compiled.end() || !cached->second.second) {
+			throw std::runtime_error("Unknown strategy: " + name);
+		}
+		return *cached->second.second;
+	}
+
+	void finish(const Job& job, const std::string& payload) {
+		results.put(job.id, payload);
+		job.connection->send(FrameType::result, job.tag, payload);
+	}
+
+	void run_compile(const Job& job) {
+		FrameReader reader(job.payload);
+		const auto name = reader.get_string();
+		const auto lang = reader.get_string();
+		const auto content = reader.get_string();
+
+		if (!valid_name(name)) {
+			job.connection->send(FrameType::error, job.tag, FrameWriter().put("Invalid strategy name: " + name).payload);
+			return;
+		}
+		const auto options = compile_options.find(lang);
+		if (options == compile_options.end()) {
+			job.connection->send(FrameType::error, job.tag, FrameWriter().put("Unknown language: " + lang).payload);
+			return;
+		}
+
+		// Resubmitting the source a name was last compiled from reuses the
+		// artifact on disk. The artifact only depends on the name, so any
+		// other source replaces the name's entry.
+		const auto source = lang + '\0' + content;
+		auto cached = compiled.find(name);
+		if (cached == compiled.end() || cached->second.first != source || (cached->second.second && !std::filesystem::exists(
+			judge.get_strategies_directory() / name / options->second.output_file_name
+		))) {
+			cached = compiled.insert_or_assign(name, std::pair{source, judge.compile(name, content, options->second)}).first;
+		}
+
+		const auto& command = cached->second.second;
+		finish(job, FrameWriter().put<uint8_t>(command.has_value()).put(command.value_or("")).payload);
+	}
+
+	// Matches long enough to reach a checkpoint are checkpointed under the
+	// state directory, keyed by pairing and round range, so a daemon
+	// restarted after a crash continues them when they are submitted again.
+	std::optional<Judge<int>::ResultHandle> compare(
+		const ExecCommand& first,
+		const ExecCommand& second,
+		const std::pair<int, int> iter_range
+	) {
+		if (iter_range.second < __checkpoint_interval) {
+			return judge.compare(first, second, iter_range);
+		}
+		const auto key = first.command + '\0' + second.command + '\0' +
+			std::to_string(iter_range.first) + '\0' + std::to_string(iter_range.second);
+		char name[32];
+		snprintf(name, sizeof(name), "%016zx", std::hash<std::string>()(key));
+		return judge.compare(first, second, iter_range, state_directory / "checkpoints" / name);
+	}
+
+	void run_match(const Job& job) {
+		FrameReader reader(job.payload);
+		const auto first = reader.get_string();
+		const auto second = reader.get_string();
+		const auto iter_min = reader.get<int32_t>();
+		const auto iter_max = reader.get<int32_t>();
+
+		const auto result = compare(resolve(first), resolve(second), {iter_min, iter_max});
+		FrameWriter writer;
+		writer.put<uint8_t>(result.has_value());
+		writer.put<int32_t>(result ? (*result)->first_score : 0);
+		writer.put<int32_t>(result ? (*result)->second_score : 0);
+		finish(job, writer.payload);
+	}
+
+	void run_report(const Job& job) {
+		std::ostringstream report;
+		judge.report_latency(report);
+		finish(job, FrameWriter().put(report.str()).payload);
+	}
+
+	// Returns false if the tournament was preempted and requeued, or abandoned
+	// because the daemon is stopping.
+	bool run_tournament(Job& job) {
+		if (job.commands.empty() && job.next_match == 0) {
+			FrameReader reader(job.payload);
+			job.iter_range.first = reader.get<int32_t>();
+			job.iter_range.second = reader.get<int32_t>();
+			const auto count = reader.get<uint32_t>();
+			for (uint32_t index = 0; index < count; index++) {
+				job.commands.push_back(resolve(reader.get_string()));
+			}
+			job.scores.assign(count, 0);
+			job.failures.assign(count, 0);
+		}
+
+		const auto count = job.commands.size();
+		const auto total = count * (count - (count > 0)) / 2;
+		while (job.next_match < total) {
+			const auto[first, second] = tournament_pair(count, job.next_match++);
+			if (const auto result = compare(job.commands[first], job.commands[second], job.iter_range)) {
+				job.scores[first] += (*result)->first_score;
+				job.scores[second] += (*result)->second_score;
+			}
+			else {
+				job.failures[first]++;
+				job.failures[second]++;
+			}
+
+			job.connection->send(
+				FrameType::progress, job.tag,
+				FrameWriter().put<uint32_t>(job.next_match).put<uint32_t>(total).payload
+			);
+
+			if (stopping) {
+				job.connection->send(FrameType::error, job.tag, FrameWriter().put(std::string("Daemon is stopping!")).payload);
+				return false;
+			}
+			if (job.next_match < total && queue.has_higher(job.priority)) {
+				const auto priority = job.priority;
+				queue.push_front(std::move(job), priority);
+				return false;
+			}
+		}
+
+		FrameWriter writer;
+		writer.put<uint32_t>(count);
+		for (size_t index = 0; index < count; index++) {
+			writer.put<int64_t>(job.scores[index]).put<uint32_t>(job.failures[index]);
+		}
+		finish(job, writer.payload);
+		return true;
+	}
+
+	void execute() {
+		while (auto job = queue.pop()) {
+			try {
+				switch (job->type) {
+					case FrameType::compile: run_compile(*job); break;
+					case FrameType::match: run_match(*job); break;
+					case FrameType::tournament: run_tournament(*job); break;
+					case FrameType::report: run_report(*job); break;
+					default: break;
+				}
+			} catch (const std::exception& err) {
+				job->connection->send(FrameType::error, job->tag, FrameWriter().put(std::string(err.what())).payload);
+			}
+		}
+	}
+
+	void read_loop(const std::shared_ptr<Connection>& connection) {
+		Frame frame;
+		while (!stopping && read_frame(connection->fd, frame)) {
+			try {
+				if (!receive(connection, frame)) {
+					break;
+				}
+			} catch (const std::runtime_error&) {
+				break; // malformed frame
+			}
+		}
+		connection->close();
+		connection->threads_done++;
+	}
+
+	// Returns false when the connection should be dropped.
+	bool receive(const std::shared_ptr<Connection>& connection, Frame& frame) {
+		const auto tag = frame.header.job_id;
+		const auto priority = frame.header.priority;
+		if ((int)priority >= __priority_count) {
+			return connection->send(FrameType::error, tag, FrameWriter().put(std::string("Invalid priority!")).payload);
+		}
+
+		switch (frame.header.type) {
+			case FrameType::fetch: {
+				FrameReader reader(frame.payload);
+				if (const auto result = results.get(reader.get<uint32_t>())) {
+					return connection->send(FrameType::result, tag, *result);
+				}
+				return connection->send(FrameType::error, tag, FrameWriter().put(std::string("Unknown job!")).payload);
+			}
+
+			case FrameType::compile:
+			case FrameType::match:
+			case FrameType::tournament:
+			case FrameType::report: {
+				// Holding the outbox lock keeps "accepted" ahead of any
+				// frame the executor sends for this job.
+				std::lock_guard lock(connection->mutex);
+				Job job = { next_job_id++, tag, frame.header.type, priority, connection, std::move(frame.payload) };
+				const auto id = job.id;
+				if (!queue.push(std::move(job), priority)) {
+					return connection->enqueue(FrameType::busy, tag, FrameWriter().put<uint32_t>(queue.size(priority)).payload);
+				}
+				return connection->enqueue(FrameType::accepted, tag, FrameWriter().put<uint32_t>(id).payload);
+			}
+
+			default:
+				return connection->send(FrameType::error, tag, FrameWriter().put(std::string("Unknown frame type!")).payload);
+		}
+	}
+
+public:
+	JudgeDaemon(
+		const std::filesystem::path& _socket_path,
+		const std::filesystem::path& strategies_directory = "strategies",
+		const std::filesystem::path& sandbox_directory = "sandbox",
+		const std::filesystem::path& _state_directory = "daemon-state"
+	):
+		socket_path(_socket_path),
+		state_directory(std::filesystem::absolute(_state_directory)),
+		judge(strategies_directory, sandbox_directory)
+	{
+		listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listen_fd < 0) {
+			throw std::runtime_error("Failed to create socket!");
+		}
+
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if (socket_path.string().size() >= sizeof(address.sun_path)) {
+			throw std::runtime_error("Socket path too long!");
+		}
+		strcpy(address.sun_path, socket_path.c_str());
+
+		std::filesystem::remove(socket_path);
+		if (bind(listen_fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(listen_fd, 64) < 0) {
+			::close(listen_fd);
+			throw std::runtime_error("Failed to listen on " + socket_path.string());
+		}
+	}
+
+	~JudgeDaemon() {
+		::close(listen_fd);
+		std::filesystem::remove(socket_path);
+	}
+
+	// Runs every strategy in a SandboxManager; see Judge::enable_sandbox.
+	// Call before serve().
+	void enable_sandbox(const SandboxOptions& options = {}) {
+		judge.enable_sandbox(options);
+	}
+
+	// Safe to call from a signal handler.
+	void stop() {
+		stopping = true;
+	}
+
+	void serve() {
+		std::thread executor(&JudgeDaemon::execute, this);
+		std::list<Session> sessions;
+
+		const auto join = [](Session& session) {
+			session.connection->close();
+			session.reader.join();
+			session.writer.join();
+		};
+
+		while (!stopping) {
+			for (auto session = sessions.begin(); session != sessions.end();) {
+				if (session->connection->threads_done == 2) {
+					join(*session);
+					session = sessions.erase(session);
+				}
+				else {
+					session++;
+				}
+			}
+
+			pollfd listen_poll = { listen_fd, POLLIN, 0 };
+			if (poll(&listen_poll, 1, __daemon_poll_interval) <= 0 || !(listen_poll.revents & POLLIN)) {
+				continue;
+			}
+			const int fd = accept(listen_fd, nullptr, nullptr);
+			if (fd >= 0) {
+				auto& session = sessions.emplace_back();
+				session.connection = std::make_shared<Connection>(fd);
+				session.writer = std::thread(&Connection::write_loop, session.connection.get());
+				session.reader = std::thread(&JudgeDaemon::read_loop, this, session.connection);
+			}
+		}
+
+		for (auto& session : sessions) {
+			join(session);
+		}
+		queue.close();
+		executor.join();
+	}
+};
@@ -0,0 +1,652 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <map>
+#include <optional>
+#include <bitset>
+#include <string>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "sandboxed-process.h"
+#include "compile-options.h"
+#include "checkpoint.h"
+#include "latency.h"
+#include "noise.h"
+#include "response-cache.h"
+
+template<class Choice>
+struct Result {
+	/*
+	using Choices = std::conditional<
+		std::is_same<Choice, bool>::value,
+		// TODO: Replace vector<bool> with dynamic_bitset
+		std::vector<bool>,
+		std::conditional<
+			std::is_same<Choice, char>::value,
+			std::string,
+			std::vector<Choice>
+		>
+	>;
+	*/
+
+	using Choices = std::vector<Choice>;
+
+	Choices first_choices;
+	Choices second_choices;
+	int first_score;
+	int second_score;
+};
+
+// Pool of match results. A slot keeps the capacity of its histories when it
+// is released, so once the pool is warm, acquiring a result for a match of
+// at most the largest length seen so far does not allocate.
+template<class Choice>
+class ResultPool {
+	std::vector<std::unique_ptr<Result<Choice>>> slots;
+	std::vector<Result<Choice>*> free_slots;
+
+	void grow(const size_t count, const int iter_max) {
+		for (size_t index = 0; index < count; index++) {
+			slots.push_back(std::make_unique<Result<Choice>>());
+			slots.back()->first_choices.reserve(iter_max);
+			slots.back()->second_choices.reserve(iter_max);
+			free_slots.reserve(slots.size());
+			free_slots.push_back(slots.back().get());
+		}
+	}
+
+public:
+	// Owns one slot until destroyed. Moving a handle does not allocate.
+	class Handle {
+		ResultPool* pool = nullptr;
+		Result<Choice>* result = nullptr;
+
+	public:
+		Handle(ResultPool* _pool, Result<Choice>* _result): pool(_pool), result(_result) {}
+		Handle(const Handle&) = delete;
+		Handle& operator=(const Handle&) = delete;
+
+		Handle(Handle&& other) noexcept: pool(other.pool), result(other.result) {
+			other.pool = nullptr;
+		}
+
+		Handle& operator=(Handle&& other) noexcept {
+			std::swap(pool, other.pool);
+			std::swap(result, other.result);
+			return *this;
+		}
+
+		~Handle() {
+			if (pool) {
+				pool->free_slots.push_back(result);
+			}
+		}
+
+		Result<Choice>& operator*() const {
+			return *result;
+		}
+
+		Result<Choice>* operator->() const {
+			return result;
+		}
+	};
+
+	void reserve(const size_t count, const int iter_max) {
+		for (auto& slot : slots) {
+			slot->first_choices.reserve(iter_max);
+			slot->second_choices.reserve(iter_max);
+		}
+		if (slots.size() < count) {
+			grow(count - slots.size(), iter_max);
+		}
+	}
+
+	Handle acquire(const int iter_limit) {
+		if (free_slots.empty()) {
+			grow(1, iter_limit);
+		}
+		const auto result = free_slots.back();
+		free_slots.pop_back();
+
+		result->first_choices.resize(iter_limit);
+		result->second_choices.resize(iter_limit);
+		result->first_score = 0;
+		result->second_score = 0;
+		return Handle(this, result);
+	}
+};
+
+template<class Choice>
+struct Strategy {
+	using StrategyKey = std::string;
+
+	std::string name;
+	std::map<StrategyKey, Result<Choice>> results;
+	double score;
+};
+
+template<class Choice>
+class Judge {
+	const int compile_message_size = 4096;
+	const int time_limit = 1;
+	const int memory_limit = 128;
+	const int __iter_min = 1;
+	const int __iter_max = (1 << 24);
+	const Choice __end_of_iter = -1;
+
+	const std::filesystem::path strategies_directory;
+	const std::filesystem::path sandbox_directory;
+
+	std::unique_ptr<SandboxManager> sandbox;
+	mutable InterpreterHostPool interpreter_hosts; // after the sandbox its hosts run in
+	std::shared_ptr<MatchPlacer> placer = std::make_shared<MatchPlacer>();
+	mutable ResultPool<Choice> results;
+	mutable ResponseCache responses;
+	mutable std::vector<uint8_t> noise_masks;
+	mutable LatencyProfiler latency;
+	mutable std::mt19937 rng{(std::mt19937::result_type)std::chrono::steady_clock::now().time_since_epoch().count()};
+
+public:
+	using ResultHandle = typename ResultPool<Choice>::Handle;
+
+	Judge(
+		const std::filesystem::path& _strategies_directory = "strategies",
+		const std::filesystem::path& _sandbox_directory = "sandbox"
+	):
+		strategies_directory(std::filesystem::absolute(_strategies_directory)),
+		sandbox_directory(std::filesystem::absolute(_sandbox_directory))
+	{
+		std::filesystem::create_directories(strategies_directory);
+		std::filesystem::create_directories(sandbox_directory);
+	}
+
+	const std::filesystem::path& get_strategies_directory() const {
+		return strategies_directory;
+	}
+
+	void set_placement_policy(const PlacementPolicy policy) {
+		placer->set_policy(policy);
+	}
+
+	void report_placement(std::ostream& out) const {
+		placer->report(out);
+	}
+
+	// Places matches with `shared` from now on, so that judges running side
+	// by side take turns over its cpu groups instead of each starting from
+	// the first one.
+	void share_placer(const std::shared_ptr<MatchPlacer>& shared) {
+		placer = shared;
+	}
+
+	// Runs strategies isolated in a SandboxManager from now on, interpreter
+	// hosts included. `sandbox_directory` must then hold a root filesystem
+	// with whatever they need at run time (e.g. the C library, python3 and
+	// java); the hosts are mounted into it from the working directory.
+	void enable_sandbox(const SandboxOptions& options = {}) {
+		auto replacement = std::make_unique<SandboxManager>(sandbox_directory, strategies_directory, options);
+		interpreter_hosts.use_sandbox(replacement.get());
+		sandbox = std::move(replacement);
+	}
+
+	const LatencyProfiler& get_latency_profiler() const {
+		return latency;
+	}
+
+	void report_latency(std::ostream& out) const {
+		latency.report(out);
+	}
+
+	void write_strategy(
+		const std::string& strategy_name,
+		const std::string& file_name,
+		const std::string& content
+	) const {
+		const auto strategy_directory = strategies_directory / strategy_name;
+		std::filesystem::create_directory(strategy_directory);
+
+		const auto strategy_path = strategy_directory / file_name;
+		std::ofstream strategy_file(strategy_path);
+		strategy_file << content;
+		if (strategy_file.fail()) {
+			throw std::runtime_error("Failed to write to strategy file: " + strategy_path.string());
+		}
+	}
+
+	std::optional<std::string> compile(
+		const std::string& strategy_name,
+		const CompileOptions& options
+	) const {
+		const auto strategy_directory = strategies_directory / strategy_name;
+		const auto input_path = strategy_directory / options.input_file_name;
+		const auto output_path = strategy_directory / options.output_file_name;
+
+		std::filesystem::remove(output_path);
+
+		// TODO: Find a better way to catch compilation error.
+		const auto compilation_command = options.get_compilation_command(input_path, output_path) + " 2>&1";
+		const auto compile_fp = popen(compilation_command.data(), "r");
+		if (!compile_fp) {
+			throw std::runtime_error("Failed to popen!");
+		}
+
+		char compile_message[compile_message_size];
+		const auto read_bytes = fread(compile_message, sizeof(*compile_message), sizeof(compile_message) - 1, compile_fp);
+		compile_message[read_bytes] = 0;
+		pclose(compile_fp);
+
+		if (!std::filesystem::exists(output_path)) {
+			return std::nullopt;
+		}
+		const auto execution_command = options.get_execution_command(output_path);
+		responses.forget(execution_command);
+		return execution_command;
+	}
+
+	auto compile(
+		const std::string& strategy_name,
+		const std::string& content,
+		const CompileOptions& options
+	) const {
+		write_strategy(strategy_name, options.input_file_name, content);
+		return compile(strategy_name, options);
+	}
+
+private:
+	enum class MatchOutcome {
+		finished,
+		invalid,
+		replay_failed
+	};
+
+	void check_iter_range(const std::pair<int, int> iter_range) const {
+		const auto[iter_min, iter_max] = iter_range;
+		if (!(iter_min <= iter_max && __iter_min <= iter_min && iter_max <= __iter_max)) {
+			throw std::range_error("Invalid range!");
+		}
+	}
+
+	// The round count is drawn from the match seed, so a resumed match keeps it.
+	MatchState start_match(const std::pair<int, int> iter_range, const std::optional<uint64_t> match_seed = std::nullopt) const {
+		const auto[iter_min, iter_max] = iter_range;
+		const uint64_t seed = match_seed ? *match_seed : (uint64_t)rng();
+		std::mt19937 match_rng(seed);
+		std::uniform_int_distribution<> random_iter_count(iter_min, iter_max);
+		return { seed, random_iter_count(match_rng), 0, 0, 0 };
+	}
+
+	static bool is_invalid(const Choice& choice) {
+		return !(choice == 0 || choice == 1);
+	}
+
+	static void calculate(
+		Result<Choice>& result,
+		const int iter,
+		const Choice& first_choice,
+		const Choice& second_choice
+	) {
+		constexpr int score_table[2][2][2] = {
+			{{0, 0}, {3, -1}},
+			{{-1, 3}, {2, 2}}
+		};
+
+		result.first_choices[iter] = first_choice;
+		result.second_choices[iter] = second_choice;
+		result.first_score += score_table[first_choice][second_choice][0];
+		result.second_score += score_table[first_choice][second_choice][1];
+	}
+
+	// Waits for both strategies' next moves at once and returns when each
+	// arrived, so that a strategy's think time ends with its own move rather
+	// than when the judge gets around to reading it. An arrival is 0 if a
+	// strategy died first; recv_int() then reports it. Nothing is returned
+	// if a strategy is still thinking after __move_timeout.
+	static std::optional<std::pair<uint64_t, uint64_t>> await_moves(SandboxedProcess& first_process, SandboxedProcess& second_process) {
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(__move_timeout);
+		uint64_t first_arrival = 0, second_arrival = 0;
+		for (int spin = 1; !first_arrival || !second_arrival; spin++) {
+			if (!first_arrival && first_process.ready()) {
+				first_arrival = read_tsc();
+			}
+			if (!second_arrival && second_process.ready()) {
+				second_arrival = read_tsc();
+			}
+			if (spin % 65536 == 0) {
+				if (!(first_process.running() && second_process.running())) {
+					break;
+				}
+				if (std::chrono::steady_clock::now() > deadline) {
+					return std::nullopt;
+				}
+			}
+		}
+		return std::pair{first_arrival, second_arrival};
+	}
+
+	// Noise masks for a whole match, drawn in one batch into a reused buffer.
+	const uint8_t* draw_noise(const MatchState& state, const NoiseOptions& noise) const {
+		if (!noise.enabled()) {
+			return nullptr;
+		}
+		if (noise_masks.size() < (size_t)state.iter_limit) {
+			noise_masks.resize(state.iter_limit);
+		}
+		fill_noise_masks(state.seed, 0, state.iter_limit, noise, noise_masks.data());
+		return noise_masks.data();
+	}
+
+	// Plays a whole match from the response tries of two deterministic
+	// strategies, without processes. Fails on the first unseen history.
+	bool play_cached(
+		const ResponseTrie& first_trie,
+		const ResponseTrie& second_trie,
+		const MatchState& state,
+		Result<Choice>& result,
+		const uint8_t* masks
+	) const {
+		int first_node = 0, second_node = 0;
+		for (int iter = 0; iter < state.iter_limit; iter++) {
+			Choice first_choice = first_trie.move(first_node);
+			Choice second_choice = second_trie.move(second_node);
+			if (first_choice < 0 || second_choice < 0) {
+				return false;
+			}
+
+			const uint8_t mask = masks ? masks[iter] : 0;
+			first_choice ^= (mask & __noise_tremble_first) != 0;
+			second_choice ^= (mask & __noise_tremble_second) != 0;
+			first_node = first_trie.child(first_node, second_choice ^ ((mask & __noise_observe_first) != 0));
+			second_node = second_trie.child(second_node, first_choice ^ ((mask & __noise_observe_second) != 0));
+
+			calculate(result, iter, first_choice, second_choice);
+		}
+		return true;
+	}
+
+	// Plays rounds [state.round, state.iter_limit) into `result`, which already
+	// holds the earlier rounds. Those are replayed into the fresh processes,
+	// and replay_failed means a harness could not resume from them.
+	// Moves of deterministic strategies are recorded into their response
+	// tries as they are received, before any noise is applied.
+	MatchOutcome play(
+		const ExecCommand& first_command,
+		const ExecCommand& second_command,
+		MatchState state,
+		Result<Choice>& result,
+		MatchCheckpoint<Choice>* checkpoint,
+		const uint8_t* masks = nullptr
+	) const {
+		const int iter_start = state.round;
+		const int iter_limit = state.iter_limit;
+		if (iter_start == iter_limit) {
+			return MatchOutcome::finished;
+		}
+
+		std::optional<ReplaySegment> first_replay, second_replay;
+		if (iter_start > 0) {
+			first_replay.emplace(result.first_choices, result.second_choices, iter_start);
+			second_replay.emplace(result.second_choices, result.first_choices, iter_start);
+		}
+
+		const auto placement = placer->place();
+		pin_to_cpu(0, placement.cpus[Placement::judge]);
+
+		SandboxedProcess first_process(
+			first_command, &interpreter_hosts,
+			placement.cpus[Placement::first], placement.node,
+			first_replay ? first_replay->feed() : ReplayFeed(),
+			sandbox.get(), 0
+		);
+		SandboxedProcess second_process(
+			second_command, &interpreter_hosts,
+			placement.cpus[Placement::second], placement.node,
+			second_replay ? second_replay->feed() : ReplayFeed(),
+			sandbox.get(), 1
+		);
+		if (!first_process.handshake() || !second_process.handshake()) {
+			return MatchOutcome::invalid;
+		}
+		if (iter_start > 0 && !(first_process.supports_replay() && second_process.supports_replay())) {
+			return MatchOutcome::replay_failed;
+		}
+
+		// Tries only follow matches played from the first round.
+		ResponseTrie* first_trie = iter_start == 0 ? responses.find(first_command.command) : nullptr;
+		ResponseTrie* second_trie = iter_start == 0 ? responses.find(second_command.command) : nullptr;
+		int first_node = first_trie ? 0 : -1;
+		int second_node = second_trie ? 0 : -1;
+
+		auto& first_latency = latency.profile(first_command.command);
+		auto& second_latency = latency.profile(second_command.command);
+		first_latency.begin_match();
+		second_latency.begin_match();
+		uint64_t round_start = read_tsc();
+
+		for (int iter = iter_start; iter < iter_limit; iter++) {
+			const auto arrivals = await_moves(first_process, second_process);
+			if (!arrivals) {
+				return MatchOutcome::invalid;
+			}
+			const auto [first_arrival, second_arrival] = *arrivals;
+
+			Choice first_choice = first_process.recv_int();
+			if (is_invalid(first_choice)) {
+				return MatchOutcome::invalid;
+			}
+
+			Choice second_choice = second_process.recv_int();
+			if (is_invalid(second_choice)) {
+				return MatchOutcome::invalid;
+			}
+
+			// The first move after a replay includes replaying the history.
+			if (iter > iter_start || iter_start == 0) {
+				const uint64_t received = read_tsc();
+				first_latency.record(iter, (first_arrival ? first_arrival : received) - round_start);
+				second_latency.record(iter, (second_arrival ? second_arrival : received) - round_start);
+			}
+
+			if (first_trie) {
+				first_trie->record(first_node, first_choice);
+			}
+			if (second_trie) {
+				second_trie->record(second_node, second_choice);
+			}
+
+			const uint8_t mask = masks ? masks[iter] : 0;
+			first_choice ^= (mask & __noise_tremble_first) != 0;
+			second_choice ^= (mask & __noise_tremble_second) != 0;
+			const Choice first_observed = second_choice ^ ((mask & __noise_observe_first) != 0);
+			const Choice second_observed = first_choice ^ ((mask & __noise_observe_second) != 0);
+
+			if (iter == iter_start && iter_start > 0 && (
+				first_process.replay_status() != replay_done ||
+				second_process.replay_status() != replay_done
+			)) {
+				return MatchOutcome::replay_failed;
+			}
+
+			if (iter < iter_limit - 1) {
+				first_process.send_int(first_observed);
+				second_process.send_int(second_observed);
+				round_start = read_tsc();
+				if (first_trie) {
+					first_node = first_trie->child_or_insert(first_node, first_observed);
+				}
+				if (second_trie) {
+					second_node = second_trie->child_or_insert(second_node, second_observed);
+				}
+			}
+			else {
+				first_process.send_int(__end_of_iter);
+				second_process.send_int(__end_of_iter);
+			}
+
+			calculate(result, iter, first_choice, second_choice);
+
+			if (checkpoint && (iter + 1) % __checkpoint_interval == 0 && iter + 1 < iter_limit) {
+				state.round = iter + 1;
+				state.first_score = result.first_score;
+				state.second_score = result.second_score;
+				checkpoint->save(
+					state, result.first_choices, result.second_choices,
+					first_command.command, second_command.command
+				);
+			}
+		}
+
+		// A hosted strategy that does not return after the last round is a failure.
+		const bool first_failed = first_process.close();
+		const bool second_failed = second_process.close();
+		if (first_failed || second_failed) {
+			return MatchOutcome::invalid;
+		}
+
+		return MatchOutcome::finished;
+	}
+
+public:
+	// Presizes the result pool so that matches of up to `iter_max` rounds
+	// run without heap allocation from the first one on.
+	void reserve(const size_t result_count, const int iter_max) const {
+		results.reserve(result_count, iter_max);
+	}
+
+	// Declares that a strategy's moves depend only on what it has been told,
+	// so that its matches can be answered from recorded responses. This lasts
+	// until the strategy is recompiled.
+	void mark_deterministic(const ExecCommand& command) const {
+		responses.mark_deterministic(command.command);
+	}
+
+	// With `noise`, moves are flipped by the judge as described in noise.h,
+	// with draws keyed by the match seed and round. A sweep over noise levels
+	// should pass the same `seed` to every level: the draws then match, and
+	// matches between deterministic strategies reuse their recorded responses.
+	std::optional<ResultHandle> compare(
+		const ExecCommand& first_command,
+		const ExecCommand& second_command,
+		const std::pair<int, int> iter_range = {200, 500},
+		const NoiseOptions& noise = {},
+		const std::optional<uint64_t> seed = std::nullopt
+	) const {
+		check_iter_range(iter_range);
+		if (!noise.valid()) {
+			throw std::range_error("Invalid noise!");
+		}
+
+		const auto state = start_match(iter_range, seed);
+		auto result = results.acquire(state.iter_limit);
+		const auto masks = draw_noise(state, noise);
+
+		const auto first_trie = responses.find(first_command.command);
+		const auto second_trie = responses.find(second_command.command);
+		if (first_trie && second_trie && play_cached(*first_trie, *second_trie, state, *result, masks)) {
+			return result;
+		}
+
+		result->first_score = result->second_score = 0;
+		if (play(first_command, second_command, state, *result, nullptr, masks) != MatchOutcome::finished) {
+			return std::nullopt;
+		}
+		return result;
+	}
+
+	// Like compare(), but checkpoints the match into `checkpoint_directory`
+	// every __checkpoint_interval rounds, and resumes from a checkpoint of the
+	// same pairing left there by an interrupted worker. Strategies whose
+	// harness cannot replay the recorded rounds start over with the same seed.
+	// Replay feeds back recorded moves, so noise is not supported here.
+	std::optional<ResultHandle> compare(
+		const ExecCommand& first_command,
+		const ExecCommand& second_command,
+		const std::pair<int, int> iter_range,
+		const std::filesystem::path& checkpoint_directory
+	) const {
+		check_iter_range(iter_range);
+
+		MatchCheckpoint<Choice> checkpoint(checkpoint_directory);
+		auto result = results.acquire(0);
+		auto state = checkpoint.load(
+			first_command.command, second_command.command,
+			result->first_choices, result->second_choices
+		);
+		if (state) {
+			result->first_score = state->first_score;
+			result->second_score = state->second_score;
+		}
+		else {
+			state = start_match(iter_range);
+			result = results.acquire(state->iter_limit);
+			checkpoint.begin(*state, first_command.command, second_command.command);
+		}
+
+		auto outcome = play(first_command, second_command, *state, *result, &checkpoint);
+		if (outcome == MatchOutcome::replay_failed) {
+			state = MatchState{ state->seed, state->iter_limit, 0, 0, 0 };
+			result = results.acquire(state->iter_limit);
+			checkpoint.begin(*state, first_command.command, second_command.command);
+			outcome = play(first_command, second_command, *state, *result, &checkpoint);
+		}
+
+		checkpoint.clear();
+		if (outcome != MatchOutcome::finished) {
+			return std::nullopt;
+		}
+		return result;
+	}
+
+	void benchmark_compare(
+		const std::string& strategy_name,
+		const std::string& lang,
+		const std::string& content,
+		const int compare_count
+	) const {
+		const int period = compare_count / 10;
+		const auto& options = compile_options.at(lang);
+		if (const auto execution_command = compile(strategy_name, content, options)) {
+			const ExecCommand command(*execution_command);
+			std::cout << "DEBUG: Start benchmark_compare";
+			std::cout << '(' << strategy_name << ", " << compare_count << ')' << std::endl;
+
+			const auto time_start = std::chrono::steady_clock::now();
+
+			for (int count = 1; count <= compare_count; count++) {
+				if (!compare(command, command)) {
+					throw std::runtime_error("Comparison error!");
+				}
+				if (count % period == 0) {
+					std::cout << "DEBUG: " << strategy_name << " - " << count << std::endl;
+				}
+			}
+
+			const auto time_end = std::chrono::steady_clock::now();
+			const std::chrono::duration<double> diff = time_end - time_start;
+			std::cout << "Time to compare " << compare_count << " times: " << diff.count() << 's' << std::endl;
+		}
+		else {
+			throw std::runtime_error("Compilation error!");
+		}
+	}
+
+	void benchmark_placement(
+		const std::string& strategy_name,
+		const std::string& lang,
+		const std::string& content,
+		const int compare_count
+	) {
+		const auto initial_policy = placer->get_policy();
+		for (const auto policy : {PlacementPolicy::none, PlacementPolicy::compact, PlacementPolicy::scatter}) {
+			std::cout << "DEBUG: Placement policy " << to_string(policy) << std::endl;
+			set_placement_policy(policy);
+			benchmark_compare(strategy_name, lang, content, compare_count);
+			report_placement(std::cout);
+		}
+		set_placement_policy(initial_policy);
+	}
+};
@@ -0,0 +1,245 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+constexpr int __latency_sub_buckets = 16; // per power of two; quantiles are within 1/16
+constexpr int __latency_buckets = 61 * __latency_sub_buckets;
+constexpr int __latency_octaves = 25;     // round octaves up to __iter_max
+constexpr int __latency_growth_octave_min = 4; // earlier rounds are dominated by warm-up
+constexpr int __latency_growth_points = 4;
+constexpr double __latency_growth_threshold = 0.5;
+
+// Raw timestamp for latency measurements. The TSC is invariant on every
+// machine we run on; elsewhere this falls back to the steady clock.
+inline uint64_t read_tsc() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Log-linear histogram of tick counts, so every quantile is within one
+// sub-bucket (1/16 of its value) of the truth at a fixed 8KB per sketch.
+class LatencySketch {
+	std::array<uint64_t, __latency_buckets> counts = {};
+	uint64_t count = 0;
+	uint64_t total = 0;
+	uint64_t max = 0;
+
+	static int bucket(const uint64_t ticks) {
+		if (ticks < __latency_sub_buckets) {
+			return ticks;
+		}
+		const int exponent = 63 - __builtin_clzll(ticks);
+		const int sub_bucket = (ticks >> (exponent - 4)) & (__latency_sub_buckets - 1);
+		return (exponent - 3) * __latency_sub_buckets + sub_bucket;
+	}
+
+	// Largest tick count that falls into `index`.
+	static uint64_t bucket_end(const int index) {
+		if (index < __latency_sub_buckets) {
+			return index;
+		}
+		const int exponent = index / __latency_sub_buckets + 3;
+		const uint64_t sub_bucket = index % __latency_sub_buckets;
+		return ((__latency_sub_buckets + sub_bucket + 1) << (exponent - 4)) - 1;
+	}
+
+public:
+	void record(const uint64_t ticks) {
+		counts[bucket(ticks)]++;
+		count++;
+		total += ticks;
+		max = std::max(max, ticks);
+	}
+
+	void merge(const LatencySketch& other) {
+		for (int index = 0; index < __latency_buckets; index++) {
+			counts[index] += other.counts[index];
+		}
+		count += other.count;
+		total += other.total;
+		max = std::max(max, other.max);
+	}
+
+	uint64_t get_count() const {
+		return count;
+	}
+
+	uint64_t get_total() const {
+		return total;
+	}
+
+	uint64_t get_max() const {
+		return max;
+	}
+
+	uint64_t quantile(const double q) const {
+		const uint64_t rank = std::ceil(q * count);
+		uint64_t seen = 0;
+		for (int index = 0; index < __latency_buckets; index++) {
+			seen += counts[index];
+			if (seen >= rank && seen > 0) {
+				return std::min(bucket_end(index), max);
+			}
+		}
+		return max;
+	}
+};
+
+// Think time of one strategy over all of its matches: the wall-clock time
+// from the judge handing it the opponent's move to its own move arriving.
+// This is not CPU time: harnesses spin while they wait, and on a contended
+// machine it includes waiting for a timeslice. Besides the sketch, ticks are
+// summed by round octave (rounds [2^k - 1, 2^(k+1) - 1)) to see how think
+// time scales with the length of the history.
+class LatencyProfile {
+	LatencySketch sketch;
+	std::array<uint64_t, __latency_octaves> octave_ticks = {};
+	std::array<uint64_t, __latency_octaves> octave_moves = {};
+	uint64_t matches = 0;
+
+public:
+	void begin_match() {
+		matches++;
+	}
+
+	void record(const int round, const uint64_t ticks) {
+		sketch.record(ticks);
+		const int octave = std::min(63 - __builtin_clzll(round + 1), __latency_octaves - 1);
+		octave_ticks[octave] += ticks;
+		octave_moves[octave]++;
+	}
+
+	void merge(const LatencyProfile& other) {
+		sketch.merge(other.sketch);
+		for (int octave = 0; octave < __latency_octaves; octave++) {
+			octave_ticks[octave] += other.octave_ticks[octave];
+			octave_moves[octave] += other.octave_moves[octave];
+		}
+		matches += other.matches;
+	}
+
+	const LatencySketch& get_sketch() const {
+		return sketch;
+	}
+
+	uint64_t get_matches() const {
+		return matches;
+	}
+
+	// Least-squares slope of log(mean think time) against log(round), so
+	// think time per move grows like round^exponent: 0 for a constant-time
+	// strategy, 1 for one that rescans its history every move. NaN until
+	// enough octaves have been played.
+	double growth_exponent() const {
+		std::vector<std::pair<double, double>> points;
+		for (int octave = __latency_growth_octave_min; octave < __latency_octaves; octave++) {
+			if (octave_moves[octave] > 0 && octave_ticks[octave] > 0) {
+				const double mean = (double)octave_ticks[octave] / octave_moves[octave];
+				points.emplace_back(octave + 0.5, std::log2(mean));
+			}
+		}
+		if ((int)points.size() < __latency_growth_points) {
+			return NAN;
+		}
+
+		double x_mean = 0, y_mean = 0;
+		for (const auto& [x, y] : points) {
+			x_mean += x / points.size();
+			y_mean += y / points.size();
+		}
+		double covariance = 0, variance = 0;
+		for (const auto& [x, y] : points) {
+			covariance += (x - x_mean) * (y - y_mean);
+			variance += (x - x_mean) * (x - x_mean);
+		}
+		return covariance / variance;
+	}
+
+	bool growing() const {
+		return growth_exponent() > __latency_growth_threshold;
+	}
+};
+
+// Latency profiles by execution command. Ticks are converted to time only
+// when reporting, against the steady clock over the profiler's lifetime.
+class LatencyProfiler {
+	std::map<std::string, LatencyProfile> profiles;
+	uint64_t tsc_start = read_tsc();
+	std::chrono::steady_clock::time_point time_start = std::chrono::steady_clock::now();
+
+	double ticks_per_second() const {
+		auto elapsed = std::chrono::steady_clock::now() - time_start;
+		if (elapsed < std::chrono::milliseconds(10)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10) - elapsed);
+			elapsed = std::chrono::steady_clock::now() - time_start;
+		}
+		return (read_tsc() - tsc_start) / std::chrono::duration<double>(elapsed).count();
+	}
+
+public:
+	// Inserts on first use; a profile's address is stable afterwards.
+	LatencyProfile& profile(const std::string& command) {
+		return profiles[command];
+	}
+
+	void merge(const LatencyProfiler& other) {
+		for (const auto& [command, profile] : other.profiles) {
+			profiles[command].merge(profile);
+		}
+	}
+
+	void clear() {
+		profiles.clear();
+	}
+
+	// Ranks strategies by the total think time they imposed on their matches.
+	// Times are wall-clock, hence think_seconds rather than cpu_seconds.
+	void report(std::ostream& out) const {
+		const double microseconds = ticks_per_second() / 1e6;
+
+		std::vector<std::pair<uint64_t, const std::string*>> ranking;
+		uint64_t total = 0;
+		for (const auto& [command, profile] : profiles) {
+			ranking.emplace_back(profile.get_sketch().get_total(), &command);
+			total += profile.get_sketch().get_total();
+		}
+		std::sort(ranking.rbegin(), ranking.rend());
+
+		out << "latency: strategies=" << profiles.size();
+		out << " think_seconds=" << total / microseconds / 1e6 << '\n';
+		for (size_t rank = 0; rank < ranking.size(); rank++) {
+			const auto& command = *ranking[rank].second;
+			const auto& profile = profiles.at(command);
+			const auto& sketch = profile.get_sketch();
+			const double growth = profile.growth_exponent();
+
+			out << "latency_rank{rank=\"" << rank + 1 << "\",command=\"" << command << "\"}";
+			out << " think_seconds=" << sketch.get_total() / microseconds / 1e6;
+			out << " share=" << (total ? (double)sketch.get_total() / total : 0);
+			out << " matches=" << profile.get_matches() << " moves=" << sketch.get_count();
+			out << " p50_us=" << sketch.quantile(0.5) / microseconds;
+			out << " p90_us=" << sketch.quantile(0.9) / microseconds;
+			out << " p99_us=" << sketch.quantile(0.99) / microseconds;
+			out << " max_us=" << sketch.get_max() / microseconds;
+			out << " growth=" << (std::isnan(growth) ? "-" : std::to_string(growth));
+			if (profile.growing()) {
+				out << " growing";
+			}
+			out << '\n';
+		}
+	}
+};
@@ -0,0 +1,449 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "judge.h"
+
+constexpr int __lattice_tile = 8; // cells per tile side; a tile of cells is two cache lines
+constexpr int __lattice_strategy_max = (1 << 16) - 1;
+
+enum class Neighbourhood { von_neumann, moore };
+
+struct LatticeOptions {
+	int width = 32;
+	int height = 32;
+	Neighbourhood neighbourhood = Neighbourhood::moore;
+	int threads = std::max(1u, std::thread::hardware_concurrency() / 3); // a match keeps three threads busy
+	std::pair<int, int> iter_range = {200, 500};
+	NoiseOptions noise = {};
+	uint64_t seed = 0;
+};
+
+// Strategy indices of a toroidal grid, stored tile by tile so that a cell's
+// neighbours are mostly in the same or an adjacent tile. The grid is padded
+// to whole tiles; padding cells are never read.
+class Lattice {
+	int width, height;
+	int tiles_x, tiles_y;
+	std::vector<uint16_t> cells;
+
+public:
+	Lattice(const int _width, const int _height):
+		width(_width), height(_height),
+		tiles_x((_width + __lattice_tile - 1) / __lattice_tile),
+		tiles_y((_height + __lattice_tile - 1) / __lattice_tile),
+		cells((size_t)tiles_x * tiles_y * __lattice_tile * __lattice_tile)
+	{}
+
+	int get_width() const {
+		return width;
+	}
+
+	int get_height() const {
+		return height;
+	}
+
+	int tile_count() const {
+		return tiles_x * tiles_y;
+	}
+
+	// Position of (x, y) in `cells`, wrapping around both edges.
+	size_t index(int x, int y) const {
+		x = (x % width + width) % width;
+		y = (y % height + height) % height;
+		const int tile = (y / __lattice_tile) * tiles_x + x / __lattice_tile;
+		return (size_t)tile * __lattice_tile * __lattice_tile + (y % __lattice_tile) * __lattice_tile + x % __lattice_tile;
+	}
+
+	int get(const int x, const int y) const {
+		return cells[index(x, y)];
+	}
+
+	void set(const int x, const int y, const int strategy) {
+		cells[index(x, y)] = strategy;
+	}
+
+	// Calls f(x, y) for every cell of `tile`.
+	template<class F>
+	void for_each_cell(const int tile, F&& f) const {
+		const int x_start = (tile % tiles_x) * __lattice_tile;
+		const int y_start = (tile / tiles_x) * __lattice_tile;
+		for (int y = y_start; y < std::min(y_start + __lattice_tile, height); y++) {
+			for (int x = x_start; x < std::min(x_start + __lattice_tile, width); x++) {
+				f(x, y);
+			}
+		}
+	}
+};
+
+// Long-lived worker threads that run one batch at a time. Harnesses die with
+// the thread that started them (PR_SET_PDEATHSIG), so a judge must keep
+// running on the same thread for its hosts to survive between batches.
+class WorkerPool {
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wakeup, finished;
+	std::function<void(int)> task;
+	std::exception_ptr error;
+	uint64_t batch = 0;
+	int running = 0;
+	bool stopping = false;
+
+	void work(const int worker) {
+		uint64_t seen = 0;
+		std::unique_lock lock(mutex);
+		for (;;) {
+			wakeup.wait(lock, [&]() { return stopping || batch != seen; });
+			if (stopping) {
+				return;
+			}
+			seen = batch;
+			lock.unlock();
+			std::exception_ptr task_error;
+			try {
+				task(worker);
+			} catch(...) {
+				task_error = std::current_exception();
+			}
+			lock.lock();
+			if (task_error && !error) {
+				error = task_error;
+			}
+			if (--running == 0) {
+				finished.notify_one();
+			}
+		}
+	}
+
+public:
+	WorkerPool(const int count) {
+		for (int worker = 0; worker < count; worker++) {
+			threads.emplace_back(&WorkerPool::work, this, worker);
+		}
+	}
+
+	~WorkerPool() {
+		{
+			std::lock_guard lock(mutex);
+			stopping = true;
+		}
+		wakeup.notify_all();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+
+	int size() const {
+		return threads.size();
+	}
+
+	// Runs f(worker) on every worker and waits for all of them. The first
+	// exception thrown by a worker is rethrown here.
+	void run(std::function<void(int)> f) {
+		std::unique_lock lock(mutex);
+		task = std::move(f);
+		error = nullptr;
+		running = threads.size();
+		batch++;
+		wakeup.notify_all();
+		finished.wait(lock, [&]() { return running == 0; });
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+};
+
+// Spatial IPD: every cell plays each of its neighbours once per generation,
+// then takes the strategy of the best-scoring cell among itself and its
+// neighbours (ties keep the current strategy).
+//
+// Without noise, a match between two strategies marked deterministic always
+// plays out the same, so such a pairing is played once, at the first
+// generation that needs it, and its per-round payoffs are kept for every
+// edge of the grid where the two meet. Any other edge plays its own match,
+// with its own seed, every generation; the judges' response caches still
+// save the deterministic side's moves. The matches a generation needs are
+// played as one batch spread over the worker threads, each with its own
+// Judge, and all judges share one MatchPlacer. Scoring and updating the
+// grid are split over the same threads by tile, updating into a second grid.
+template<class Choice>
+class SpatialTournament {
+	const std::vector<ExecCommand> commands;
+	const LatticeOptions options;
+	std::vector<std::unique_ptr<Judge<Choice>>> judges;
+	std::vector<uint8_t> deterministic;
+
+	Lattice lattice, next_lattice;
+	std::vector<double> scores; // by Lattice::index()
+	std::mt19937_64 seed_rng;
+	int generation = 0;
+
+	// payoffs[first * size + second] is first's mean payoff per round against
+	// second, from the latest match between them; `known` marks the ones
+	// that are kept for later generations.
+	std::vector<double> payoffs;
+	std::vector<uint8_t> known;
+
+	// Payoffs of the latest match on each edge that is not reusable(), as
+	// (cell, neighbour) at edge_payoffs[Lattice::index() * half + slot] for
+	// the forward offset offsets()[half + slot] of the cell.
+	std::vector<std::pair<double, double>> edge_payoffs;
+
+	std::shared_ptr<MatchPlacer> placer = std::make_shared<MatchPlacer>();
+
+	// Declared last, so the threads stop before anything they use is destroyed.
+	WorkerPool workers;
+
+	// Opposite offsets mirror each other around the middle of the list, so
+	// the second half are the forward offsets that enumerate each edge once.
+	const std::vector<std::pair<int, int>>& offsets() const {
+		static const std::vector<std::pair<int, int>> von_neumann = {
+			{0, -1}, {-1, 0}, {1, 0}, {0, 1}
+		};
+		static const std::vector<std::pair<int, int>> moore = {
+			{-1, -1}, {0, -1}, {1, -1}, {-1, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1}
+		};
+		return options.neighbourhood == Neighbourhood::moore ? moore : von_neumann;
+	}
+
+	template<class F>
+	void parallel(const int count, F&& f) {
+		std::atomic<int> next = 0;
+		workers.run([&](int) {
+			for (int item = next++; item < count; item = next++) {
+				f(item);
+			}
+		});
+	}
+
+	template<class F>
+	void parallel_judges(const int count, F&& f) {
+		std::atomic<int> next = 0;
+		workers.run([&](const int worker) {
+			for (int item = next++; item < count; item = next++) {
+				f(*judges[worker], item);
+			}
+		});
+	}
+
+	bool reusable(const int first, const int second) const {
+		return !options.noise.enabled() && deterministic[first] && deterministic[second];
+	}
+
+	// Plays the pairings on the grid whose payoffs are kept but not known
+	// yet, and a match on every other edge.
+	void play_generation() {
+		const size_t size = commands.size();
+		const size_t half = offsets().size() / 2;
+		struct Match {
+			int first, second;
+			size_t edge; // SIZE_MAX for a pairing whose payoffs are kept
+		};
+		std::vector<uint8_t> needed(size * size);
+		std::vector<Match> matches;
+		for (int y = 0; y < lattice.get_height(); y++) {
+			for (int x = 0; x < lattice.get_width(); x++) {
+				const int strategy = lattice.get(x, y);
+				for (size_t slot = 0; slot < half; slot++) {
+					const auto [dx, dy] = offsets()[half + slot];
+					const int neighbour = lattice.get(x + dx, y + dy);
+					if (!reusable(strategy, neighbour)) {
+						matches.push_back({ strategy, neighbour, lattice.index(x, y) * half + slot });
+						continue;
+					}
+					const auto [first, second] = std::minmax(strategy, neighbour);
+					const size_t pairing = first * size + second;
+					if (!known[pairing] && !needed[pairing]) {
+						needed[pairing] = true;
+						matches.push_back({ first, second, SIZE_MAX });
+					}
+				}
+			}
+		}
+
+		// Seeds are drawn here, in grid order, so a run is reproducible
+		// whatever the number of threads.
+		std::vector<uint64_t> seeds(matches.size());
+		for (auto& seed : seeds) {
+			seed = seed_rng();
+		}
+
+		std::vector<std::pair<double, double>> batch(matches.size());
+		std::atomic<bool> failed = false;
+		parallel_judges(matches.size(), [&](const Judge<Choice>& judge, const int index) {
+			const auto& match = matches[index];
+			const auto result = judge.compare(commands[match.first], commands[match.second], options.iter_range, options.noise, seeds[index]);
+			if (!result) {
+				failed = true;
+				return;
+			}
+			const double rounds = (*result)->first_choices.size();
+			batch[index] = { (*result)->first_score / rounds, (*result)->second_score / rounds };
+		});
+		if (failed) {
+			throw std::runtime_error("Failed to play lattice generation " + std::to_string(generation) + '!');
+		}
+
+		for (size_t index = 0; index < matches.size(); index++) {
+			const auto& match = matches[index];
+			if (match.edge != SIZE_MAX) {
+				edge_payoffs[match.edge] = batch[index];
+				continue;
+			}
+			payoffs[match.first * size + match.second] = batch[index].first;
+			payoffs[match.second * size + match.first] = batch[index].second;
+			known[match.first * size + match.second] = known[match.second * size + match.first] = true;
+		}
+	}
+
+public:
+	SpatialTournament(
+		const std::vector<ExecCommand>& _commands,
+		const LatticeOptions& _options,
+		const std::filesystem::path& strategies_directory = "strategies",
+		const std::filesystem::path& sandbox_directory = "sandbox"
+	):
+		commands(_commands),
+		options(_options),
+		deterministic(_commands.size()),
+		lattice(_options.width, _options.height),
+		next_lattice(_options.width, _options.height),
+		scores(lattice.tile_count() * __lattice_tile * __lattice_tile),
+		seed_rng(_options.seed),
+		payoffs(_commands.size() * _commands.size()),
+		known(_commands.size() * _commands.size()),
+		edge_payoffs(scores.size() * offsets().size() / 2),
+		workers(_options.threads)
+	{
+		if (commands.empty() || commands.size() > __lattice_strategy_max) {
+			throw std::runtime_error("Failed to create lattice: invalid strategy count!");
+		}
+		if (options.width < 1 || options.height < 1 || options.threads < 1 || !options.noise.valid()) {
+			throw std::runtime_error("Failed to create lattice: invalid options!");
+		}
+		for (int thread = 0; thread < options.threads; thread++) {
+			judges.push_back(std::make_unique<Judge<Choice>>(strategies_directory, sandbox_directory));
+			judges.back()->share_placer(placer);
+		}
+	}
+
+	// With a policy, threads beyond the policy's cpu groups share groups.
+	void set_placement_policy(const PlacementPolicy policy) {
+		placer->set_policy(policy);
+	}
+
+	void report_placement(std::ostream& out) const {
+		placer->report(out);
+	}
+
+	// Marks commands[strategy] deterministic in every judge; see Judge::mark_deterministic.
+	void mark_deterministic(const int strategy) {
+		deterministic[strategy] = true;
+		for (const auto& judge : judges) {
+			judge->mark_deterministic(commands[strategy]);
+		}
+	}
+
+	const Lattice& get_lattice() const {
+		return lattice;
+	}
+
+	void set_cell(const int x, const int y, const int strategy) {
+		lattice.set(x, y, strategy);
+	}
+
+	// Fills the grid with strategies drawn uniformly from the options' seed.
+	void randomize() {
+		std::mt19937_64 cell_rng(options.seed);
+		std::uniform_int_distribution<int> strategy(0, commands.size() - 1);
+		for (int y = 0; y < lattice.get_height(); y++) {
+			for (int x = 0; x < lattice.get_width(); x++) {
+				lattice.set(x, y, strategy(cell_rng));
+			}
+		}
+	}
+
+	int get_generation() const {
+		return generation;
+	}
+
+	double get_score(const int x, const int y) const {
+		return scores[lattice.index(x, y)];
+	}
+
+	// Think time of every strategy over all generations, across all judges.
+	void report_latency(std::ostream& out) const {
+		LatencyProfiler latency;
+		for (const auto& judge : judges) {
+			latency.merge(judge->get_latency_profiler());
+		}
+		latency.report(out);
+	}
+
+	// Cells held by each strategy.
+	std::vector<int> census() const {
+		std::vector<int> counts(commands.size());
+		for (int y = 0; y < lattice.get_height(); y++) {
+			for (int x = 0; x < lattice.get_width(); x++) {
+				counts[lattice.get(x, y)]++;
+			}
+		}
+		return counts;
+	}
+
+	void step() {
+		play_generation();
+
+		const size_t size = commands.size();
+		const size_t half = offsets().size() / 2;
+		parallel(lattice.tile_count(), [&](const int tile) {
+			lattice.for_each_cell(tile, [&](const int x, const int y) {
+				const int strategy = lattice.get(x, y);
+				double score = 0;
+				for (size_t offset = 0; offset < offsets().size(); offset++) {
+					const auto [dx, dy] = offsets()[offset];
+					const int neighbour = lattice.get(x + dx, y + dy);
+					if (reusable(strategy, neighbour)) {
+						score += payoffs[strategy * size + neighbour];
+					}
+					else if (offset >= half) {
+						score += edge_payoffs[lattice.index(x, y) * half + offset - half].first;
+					}
+					else {
+						score += edge_payoffs[lattice.index(x + dx, y + dy) * half + half - 1 - offset].second;
+					}
+				}
+				scores[lattice.index(x, y)] = score;
+			});
+		});
+
+		parallel(lattice.tile_count(), [&](const int tile) {
+			lattice.for_each_cell(tile, [&](const int x, const int y) {
+				int best = lattice.get(x, y);
+				double best_score = scores[lattice.index(x, y)];
+				for (const auto& [dx, dy] : offsets()) {
+					const double score = scores[lattice.index(x + dx, y + dy)];
+					if (score > best_score) {
+						best = lattice.get(x + dx, y + dy);
+						best_score = score;
+					}
+				}
+				next_lattice.set(x, y, best);
+			});
+		});
+
+		std::swap(lattice, next_lattice);
+		generation++;
+	}
+};
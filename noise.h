@@ -0,0 +1,84 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+// 3"). A pure function of (key, counter), so any round's draws can be made
+// independently, in any order, on any thread.
+inline std::array<uint32_t, 4> philox4x32(std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key) {
+	constexpr uint64_t multiplier0 = 0xD2511F53;
+	constexpr uint64_t multiplier1 = 0xCD9E8D57;
+	constexpr uint32_t weyl0 = 0x9E3779B9;
+	constexpr uint32_t weyl1 = 0xBB67AE85;
+
+	for (int round = 0; round < 10; round++) {
+		const uint64_t product0 = multiplier0 * counter[0];
+		const uint64_t product1 = multiplier1 * counter[2];
+		counter = {
+			(uint32_t)(product1 >> 32) ^ counter[1] ^ key[0],
+			(uint32_t)product1,
+			(uint32_t)(product0 >> 32) ^ counter[3] ^ key[1],
+			(uint32_t)product0
+		};
+		key[0] += weyl0;
+		key[1] += weyl1;
+	}
+	return counter;
+}
+
+// Trembling-hand noise flips a move as it is made, and is recorded and
+// scored that way. Observation noise flips only what the opponent is told.
+struct NoiseOptions {
+	double tremble = 0;
+	double observation = 0;
+
+	// Both probabilities are in [0, 1]; this also rejects NaN.
+	bool valid() const {
+		return 0 <= tremble && tremble <= 1 && 0 <= observation && observation <= 1;
+	}
+
+	bool enabled() const {
+		return tremble > 0 || observation > 0;
+	}
+};
+
+// Bits of a per-round noise mask.
+constexpr uint8_t __noise_tremble_first = 1;
+constexpr uint8_t __noise_tremble_second = 2;
+constexpr uint8_t __noise_observe_first = 4;  // first is told the wrong move
+constexpr uint8_t __noise_observe_second = 8; // second is told the wrong move
+
+// Fills masks[0, count) for rounds [first_round, first_round + count) of the
+// match keyed by `seed`. One Philox block per round provides the four draws.
+// Flips compare the draws against p * 2^32, so raising p only adds flips, and
+// every noise level of a sweep sees the same draws. The loop has no
+// cross-round dependency, so the compiler can vectorize it.
+inline void fill_noise_masks(
+	const uint64_t seed,
+	const uint32_t first_round,
+	const size_t count,
+	const NoiseOptions& noise,
+	uint8_t* masks
+) {
+	// Clamped, so an out-of-range or NaN p never reaches the cast.
+	const auto threshold = [](const double p) {
+		if (!(p > 0)) {
+			return uint64_t(0);
+		}
+		return p >= 1 ? (uint64_t(1) << 32) : (uint64_t)(p * 4294967296.0);
+	};
+	const uint64_t tremble = threshold(noise.tremble);
+	const uint64_t observation = threshold(noise.observation);
+	const std::array<uint32_t, 2> key = { (uint32_t)seed, (uint32_t)(seed >> 32) };
+
+	for (size_t index = 0; index < count; index++) {
+		const auto draws = philox4x32({ (uint32_t)(first_round + index), 0, 0, 0 }, key);
+		masks[index] = (
+			(draws[0] < tremble ? __noise_tremble_first : 0) |
+			(draws[1] < tremble ? __noise_tremble_second : 0) |
+			(draws[2] < observation ? __noise_observe_first : 0) |
+			(draws[3] < observation ? __noise_observe_second : 0)
+		);
+	}
+}
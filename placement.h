@@ -0,0 +1,342 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+constexpr int __mpol_preferred = 1; // MPOL_PREFERRED from <numaif.h>
+
+enum class PlacementPolicy {
+	none,    // leave it to the scheduler
+	compact, // judge and both strategies on distinct cores sharing a cache
+	scatter  // spread across packages, as the worst case for benchmarks
+};
+
+inline const char* to_string(const PlacementPolicy policy) {
+	switch (policy) {
+		case PlacementPolicy::compact: return "compact";
+		case PlacementPolicy::scatter: return "scatter";
+		default: return "none";
+	}
+}
+
+struct CpuInfo {
+	int cpu;
+	int core;
+	int package;
+	int node = 0;
+	int l2 = -1; // lowest cpu sharing the L2, as a domain id
+	int l3 = -1; // lowest cpu sharing the L3, as a domain id
+};
+
+// Parses sysfs cpu lists such as "0-3,8-11".
+inline std::vector<int> parse_cpu_list(const std::string& list) {
+	std::vector<int> cpus;
+	std::stringstream stream(list);
+	for (std::string range; std::getline(stream, range, ',');) {
+		if (range.empty() || range == "\n") {
+			continue;
+		}
+		const auto dash = range.find('-');
+		const int first = std::stoi(range.substr(0, dash));
+		const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+		for (int cpu = first; cpu <= last; cpu++) {
+			cpus.push_back(cpu);
+		}
+	}
+	return cpus;
+}
+
+class CpuTopology {
+	static std::string read_line(const std::filesystem::path& path) {
+		std::ifstream file(path);
+		std::string line;
+		std::getline(file, line);
+		return line;
+	}
+
+public:
+	std::vector<CpuInfo> cpus;
+
+	// Missing sysfs entries (e.g. in containers) degrade to one core per cpu
+	// on package 0 and node 0.
+	static CpuTopology read(const std::filesystem::path& root = "/sys/devices/system") {
+		CpuTopology topology;
+
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		sched_getaffinity(0, sizeof(allowed), &allowed);
+
+		const auto online = parse_cpu_list(read_line(root / "cpu" / "online"));
+		for (const int cpu : online) {
+			if (!CPU_ISSET(cpu, &allowed)) {
+				continue;
+			}
+
+			const auto cpu_directory = root / "cpu" / ("cpu" + std::to_string(cpu));
+			const auto core_id = read_line(cpu_directory / "topology" / "core_id");
+			const auto package_id = read_line(cpu_directory / "topology" / "physical_package_id");
+
+			CpuInfo info = {
+				cpu,
+				core_id.empty() ? cpu : std::stoi(core_id),
+				package_id.empty() ? 0 : std::stoi(package_id)
+			};
+
+			for (int index = 0; std::filesystem::exists(cpu_directory / "cache" / ("index" + std::to_string(index))); index++) {
+				const auto cache_directory = cpu_directory / "cache" / ("index" + std::to_string(index));
+				const auto shared = parse_cpu_list(read_line(cache_directory / "shared_cpu_list"));
+				const auto level = read_line(cache_directory / "level");
+				if (shared.empty() || read_line(cache_directory / "type") == "Instruction") {
+					continue;
+				}
+				if (level == "2") {
+					info.l2 = shared.front();
+				}
+				else if (level == "3") {
+					info.l3 = shared.front();
+				}
+			}
+
+			topology.cpus.push_back(info);
+		}
+
+		std::error_code error;
+		for (const auto& node_entry : std::filesystem::directory_iterator(root / "node", error)) {
+			const auto name = node_entry.path().filename().string();
+			if (name.rfind("node", 0) != 0 || name.size() == 4 || !isdigit(name[4])) {
+				continue;
+			}
+			const int node = std::stoi(name.substr(4));
+			for (const int cpu : parse_cpu_list(read_line(node_entry.path() / "cpulist"))) {
+				for (auto& info : topology.cpus) {
+					if (info.cpu == cpu) {
+						info.node = node;
+					}
+				}
+			}
+		}
+
+		for (auto& info : topology.cpus) {
+			// A cpu without an L3 entry shares its last-level cache with its package.
+			if (info.l3 < 0) {
+				info.l3 = info.package << 16;
+			}
+			if (info.l2 < 0) {
+				info.l2 = info.cpu;
+			}
+		}
+		return topology;
+	}
+};
+
+struct Placement {
+	static constexpr int judge = 0;
+	static constexpr int first = 1;
+	static constexpr int second = 2;
+
+	int node = -1;
+	std::array<int, 3> cpus = {-1, -1, -1};
+};
+
+inline void pin_to_cpu(const int pid, const int cpu) {
+	if (cpu < 0) {
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	sched_setaffinity(pid, sizeof(set), &set);
+}
+
+// Pins every thread of `pid`, which sched_setaffinity() alone does not: it
+// only applies to the thread whose id is `pid`. Threads started afterwards
+// inherit the affinity of the thread that starts them. A negative `cpu`
+// unpins them. Reads the thread ids with getdents64 into a stack buffer, so
+// that matches against hosted strategies stay off the heap.
+inline void pin_process_to_cpu(const int pid, const int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (cpu < 0) {
+		for (int any = 0; any < CPU_SETSIZE; any++) {
+			CPU_SET(any, &set);
+		}
+	}
+	else {
+		CPU_SET(cpu, &set);
+	}
+
+	char path[32];
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+	const int directory = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (directory == -1) {
+		return;
+	}
+	alignas(dirent64) char entries[1024];
+	for (long size; (size = syscall(SYS_getdents64, directory, entries, sizeof(entries))) > 0;) {
+		for (long offset = 0; offset < size;) {
+			const auto entry = (const dirent64*)(entries + offset);
+			if (entry->d_name[0] != '.') {
+				sched_setaffinity(std::atoi(entry->d_name), sizeof(set), &set);
+			}
+			offset += entry->d_reclen;
+		}
+	}
+	close(directory);
+}
+
+// Asks the kernel to back [addr, addr + size) with memory from `node`.
+// Failure (e.g. no NUMA support) only loses locality, so it is ignored.
+inline void prefer_node(void* addr, const size_t size, const int node) {
+	if (node < 0 || node >= 64) {
+		return;
+	}
+	const unsigned long node_mask = 1UL << node;
+	syscall(SYS_mbind, addr, size, __mpol_preferred, &node_mask, 64, 0);
+}
+
+class MatchPlacer {
+	CpuTopology topology;
+	PlacementPolicy policy;
+
+	// Per policy, groups of three cpus that one match may occupy.
+	std::vector<std::array<int, 3>> groups;
+	size_t next_group = 0;
+
+	std::map<int, long long> cpu_assignments;
+	std::map<int, long long> node_assignments;
+
+	mutable std::mutex mutex; // judges running side by side may share a placer
+
+	int node_of(const int cpu) const {
+		for (const auto& info : topology.cpus) {
+			if (info.cpu == cpu) {
+				return info.node;
+			}
+		}
+		return -1;
+	}
+
+	// Cpus are taken one per physical core first, and SMT siblings only once a
+	// cache domain has run out of cores.
+	static std::vector<int> by_core(const std::vector<CpuInfo>& cpus) {
+		std::vector<int> primary, siblings;
+		std::set<std::pair<int, int>> cores;
+		for (const auto& info : cpus) {
+			(cores.insert({info.package, info.core}).second ? primary : siblings).push_back(info.cpu);
+		}
+		primary.insert(primary.end(), siblings.begin(), siblings.end());
+		return primary;
+	}
+
+	void build_groups() {
+		groups.clear();
+		if (policy == PlacementPolicy::compact) {
+			std::map<int, std::vector<CpuInfo>> domains;
+			for (const auto& info : topology.cpus) {
+				domains[info.l3].push_back(info);
+			}
+			for (const auto& [l3, domain] : domains) {
+				// Keep L2 neighbours adjacent so that a group shares the L2 when it can.
+				auto sorted = domain;
+				std::stable_sort(sorted.begin(), sorted.end(), [](const CpuInfo& a, const CpuInfo& b) {
+					return a.l2 < b.l2;
+				});
+				const auto cpus = by_core(sorted);
+				for (size_t index = 0; index + 3 <= cpus.size(); index += 3) {
+					groups.push_back({cpus[index], cpus[index + 1], cpus[index + 2]});
+				}
+			}
+		}
+		else if (policy == PlacementPolicy::scatter) {
+			std::map<int, std::vector<CpuInfo>> packages;
+			for (const auto& info : topology.cpus) {
+				packages[info.package].push_back(info);
+			}
+			std::vector<std::vector<int>> columns;
+			for (const auto& [package, cpus] : packages) {
+				columns.push_back(by_core(cpus));
+			}
+			std::vector<int> order;
+			for (size_t row = 0; order.size() < topology.cpus.size(); row++) {
+				for (const auto& column : columns) {
+					if (row < column.size()) {
+						order.push_back(column[row]);
+					}
+				}
+			}
+			for (size_t index = 0; index + 3 <= order.size(); index += 3) {
+				groups.push_back({order[index], order[index + 1], order[index + 2]});
+			}
+		}
+	}
+
+public:
+	MatchPlacer(const PlacementPolicy _policy = PlacementPolicy::none):
+		topology(CpuTopology::read()),
+		policy(_policy)
+	{
+		build_groups();
+	}
+
+	PlacementPolicy get_policy() const {
+		std::lock_guard lock(mutex);
+		return policy;
+	}
+
+	// Also starts the assignment counts over, so report() covers this policy only.
+	void set_policy(const PlacementPolicy _policy) {
+		std::lock_guard lock(mutex);
+		policy = _policy;
+		next_group = 0;
+		cpu_assignments.clear();
+		node_assignments.clear();
+		build_groups();
+	}
+
+	// Hands out cpu groups round-robin. Machines too small for a group fall
+	// back to no pinning.
+	Placement place() {
+		std::lock_guard lock(mutex);
+		Placement placement;
+		if (groups.empty()) {
+			return placement;
+		}
+
+		placement.cpus = groups[next_group++ % groups.size()];
+		placement.node = node_of(placement.cpus[Placement::judge]);
+
+		for (const int cpu : placement.cpus) {
+			cpu_assignments[cpu]++;
+		}
+		node_assignments[placement.node]++;
+		return placement;
+	}
+
+	void report(std::ostream& out) const {
+		std::lock_guard lock(mutex);
+		out << "placement: policy=" << to_string(policy);
+		out << " cpus=" << topology.cpus.size() << " groups=" << groups.size() << '\n';
+		for (const auto& [cpu, count] : cpu_assignments) {
+			out << "placement_cpu_assignments{cpu=\"" << cpu << "\"} " << count << '\n';
+		}
+		for (const auto& [node, count] : node_assignments) {
+			out << "placement_node_assignments{node=\"" << node << "\"} " << count << '\n';
+		}
+	}
+};
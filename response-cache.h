@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+constexpr size_t __response_trie_nodes = 1 << 22;
+
+// Moves of a deterministic strategy, keyed by what it has been told so far.
+// Node 0 is the empty history. A node's move is what the strategy plays
+// next, and its children follow the next opponent move it observes.
+class ResponseTrie {
+	struct Node {
+		int32_t children[2] = {-1, -1};
+		int8_t move = -1;
+	};
+
+	std::vector<Node> nodes = {Node()};
+
+public:
+	// -1 while the move is unknown.
+	int move(const int node) const {
+		return node < 0 ? -1 : nodes[node].move;
+	}
+
+	void record(const int node, const int move) {
+		if (node >= 0) {
+			nodes[node].move = move;
+		}
+	}
+
+	// -1 if the history has not been seen.
+	int child(const int node, const int observed) const {
+		return node < 0 ? -1 : nodes[node].children[observed];
+	}
+
+	// -1 once the trie is full; recording then stops along that path.
+	int child_or_insert(const int node, const int observed) {
+		if (node < 0) {
+			return -1;
+		}
+		if (nodes[node].children[observed] < 0) {
+			if (nodes.size() >= __response_trie_nodes) {
+				return -1;
+			}
+			nodes[node].children[observed] = nodes.size();
+			nodes.emplace_back();
+		}
+		return nodes[node].children[observed];
+	}
+};
+
+// Response tries for the strategies known to be deterministic, by command.
+class ResponseCache {
+	std::map<std::string, ResponseTrie> tries;
+
+public:
+	void mark_deterministic(const std::string& command) {
+		tries.try_emplace(command);
+	}
+
+	// Drops everything known about a command, e.g. after recompiling it.
+	void forget(const std::string& command) {
+		tries.erase(command);
+	}
+
+	ResponseTrie* find(const std::string& command) {
+		const auto trie = tries.find(command);
+		return trie == tries.end() ? nullptr : &trie->second;
+	}
+};
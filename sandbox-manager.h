@@ -0,0 +1,632 @@
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <grp.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <wait.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/sched.h>
+#include <linux/seccomp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/resource.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "placement.h"
+
+constexpr int __sandbox_slots = 2; // one per strategy of a match
+constexpr int __sandbox_uid = 12345;
+constexpr int __sandbox_gid = 12345;
+constexpr const char* __sandbox_hostname = "playground";
+constexpr const char* __sandbox_judge_cgroup = "worker-ipd-judge";
+constexpr int __ioprio_who_process = 1; // IOPRIO_WHO_PROCESS from <linux/ioprio.h>
+
+#if defined(__x86_64__)
+constexpr uint32_t __sandbox_audit_arch = AUDIT_ARCH_X86_64;
+#elif defined(__aarch64__)
+constexpr uint32_t __sandbox_audit_arch = AUDIT_ARCH_AARCH64;
+#else
+constexpr uint32_t __sandbox_audit_arch = 0; // no seccomp filter for this architecture
+#endif
+
+struct SandboxOptions {
+	// cgroup2 mount point; "/sys/fs/cgroup/unified" on hybrid hierarchies.
+	std::filesystem::path cgroup_root = "/sys/fs/cgroup";
+	int memory_limit = 128; // MB per strategy, 0: none
+	int pids_limit = 16;    // per strategy, 0: none
+	int cpu_limit = 1;      // CPUs per strategy, 0: none
+	int host_memory_limit = 2048; // MB per interpreter host, 0: none
+	int host_pids_limit = 256;    // per interpreter host, 0: none
+};
+
+// Pre-built isolation for the strategies of one judge, replacing an nsjail
+// invocation per execution:
+//
+//   nsjail --user 12345 --group 12345 --hostname playground --max_cpus 1
+//     --rlimit_as 128 --bindmount_ro <strategies> --chroot <sandbox> -- <strategy>
+//
+// Everything expensive happens once, in the constructor. A holder process
+// creates user, mount, UTS and network namespaces. It bind-mounts the
+// strategies read-only into the root filesystem in `sandbox_directory`, at
+// their usual path, and pivots into it. Each slot gets a cgroup with the
+// limits. spawn() then only has to clone3() straight into a slot's cgroup,
+// join the holder's namespaces, drop to the sandbox user, and install the
+// seccomp filter built here before exec.
+//
+// The IPC namespace is shared on purpose: the channel is SysV shm. The
+// filter only lets a strategy attach its own channel and replay segment,
+// and signal itself. There is no PID namespace, and both slots run as the
+// same user, so every system call that signals, reprioritises, limits or
+// inspects another process is either refused or restricted to the caller.
+//
+// Interpreter hosts get a slot of their own from add_host_slot() and are
+// started with spawn_host(). A host serves many matches, so its channels
+// are not known when it starts: its filter hands every shmat() to the judge
+// instead, which answers through allow_attachments().
+class SandboxManager {
+	struct Slot {
+		std::filesystem::path path;
+		int fd = -1;
+	};
+
+	// Per-spawn values patched into the filter by the child before install.
+	enum FilterValue { own_pid, channel_shmid, replay_shmid };
+
+	struct Filter {
+		std::vector<sock_filter> program;
+		std::vector<std::pair<size_t, FilterValue>> values;
+	};
+
+	pid_t holder = -1;
+	int user_fd = -1, mount_fd = -1, uts_fd = -1, network_fd = -1;
+	SandboxOptions options;
+	std::filesystem::path slot_base;
+	std::vector<Slot> slots;
+	Filter strategy_filter, host_filter;
+	// The judge's working directory, against which the hosts' commands
+	// (e.g. "hosts/python_host.py") resolve; its hosts are mounted there.
+	std::filesystem::path host_directory;
+
+	static bool write_text(const char* path, const char* text) {
+		const int fd = open(path, O_WRONLY | O_CLOEXEC);
+		if (fd == -1) {
+			return false;
+		}
+		const ssize_t length = strlen(text);
+		const bool written = write(fd, text, length) == length;
+		return (close(fd) == 0) && written;
+	}
+
+	static void write_or_throw(const std::filesystem::path& path, const std::string& text) {
+		if (!write_text(path.c_str(), text.c_str())) {
+			throw std::runtime_error("Failed to write " + path.string() + ": " + strerror(errno));
+		}
+	}
+
+	static std::filesystem::path own_cgroup() {
+		std::ifstream cgroup_file("/proc/self/cgroup");
+		std::string line;
+		while (std::getline(cgroup_file, line)) {
+			if (line.rfind("0::", 0) == 0) {
+				return line.substr(3);
+			}
+		}
+		throw std::runtime_error("Failed to find the cgroup2 hierarchy!");
+	}
+
+	// Slots are created next to the judge's cgroup. Controllers can only be
+	// enabled there once the judge has moved into a leaf of its own.
+	void create_slots() {
+		slot_base = options.cgroup_root / own_cgroup().relative_path();
+		if (slot_base.filename() == __sandbox_judge_cgroup) {
+			slot_base = slot_base.parent_path();
+		}
+
+		std::string controllers;
+		if (options.memory_limit > 0 || options.host_memory_limit > 0) controllers += " +memory";
+		if (options.pids_limit > 0 || options.host_pids_limit > 0) controllers += " +pids";
+		if (options.cpu_limit > 0) controllers += " +cpu";
+		if (!controllers.empty() && !write_text((slot_base / "cgroup.subtree_control").c_str(), controllers.c_str() + 1)) {
+			std::filesystem::create_directories(slot_base / __sandbox_judge_cgroup);
+			write_or_throw(slot_base / __sandbox_judge_cgroup / "cgroup.procs", "0");
+			write_or_throw(slot_base / "cgroup.subtree_control", controllers.substr(1));
+		}
+
+		for (int index = 0; index < __sandbox_slots; index++) {
+			create_slot(options.memory_limit, options.pids_limit);
+		}
+	}
+
+	int create_slot(const int memory_limit, const int pids_limit) {
+		static std::atomic<int> counter = 0;
+		Slot slot;
+		slot.path = slot_base / ("worker-ipd-sandbox-" + std::to_string(getpid()) + '-' + std::to_string(counter++));
+		if (!std::filesystem::create_directory(slot.path)) {
+			throw std::runtime_error("Failed to create cgroup: " + slot.path.string());
+		}
+		slots.push_back(slot);
+
+		if (memory_limit > 0) {
+			write_or_throw(slot.path / "memory.max", std::to_string((long long)memory_limit << 20));
+			write_text((slot.path / "memory.swap.max").c_str(), "0"); // absent without swap accounting
+		}
+		if (pids_limit > 0) {
+			write_or_throw(slot.path / "pids.max", std::to_string(pids_limit));
+		}
+		if (options.cpu_limit > 0) {
+			write_or_throw(slot.path / "cpu.max", std::to_string(options.cpu_limit * 100000) + " 100000");
+		}
+
+		slots.back().fd = open(slot.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (slots.back().fd == -1) {
+			throw std::runtime_error("Failed to open cgroup: " + slot.path.string());
+		}
+		return slots.size() - 1;
+	}
+
+	// Hosted filters hand shmat() to the judge instead of checking it here.
+	static Filter build_filter(const bool hosted) {
+		Filter result;
+		auto& filter = result.program;
+		auto& filter_values = result.values;
+		const auto statement = [&](const uint16_t code, const uint32_t k) {
+			filter.push_back(BPF_STMT(code, k));
+		};
+		const auto jump = [&](const uint16_t code, const uint32_t k, const uint8_t jt, const uint8_t jf) {
+			filter.push_back(BPF_JUMP(code, k, jt, jf));
+		};
+		const uint32_t fail = SECCOMP_RET_ERRNO | EPERM;
+		const auto load_nr = [&]() {
+			statement(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, nr));
+		};
+		const auto load_arg = [&](const int arg) {
+			statement(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, args) + arg * sizeof(uint64_t));
+		};
+		const auto load_arg0 = [&]() {
+			load_arg(0);
+		};
+
+		statement(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, arch));
+		jump(BPF_JMP | BPF_JEQ | BPF_K, __sandbox_audit_arch, 1, 0);
+		statement(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS);
+		load_nr();
+#if defined(__x86_64__)
+		jump(BPF_JMP | BPF_JGE | BPF_K, __X32_SYSCALL_BIT, 0, 1);
+		statement(BPF_RET | BPF_K, fail);
+#endif
+
+		for (const long nr : {
+			SYS_ptrace, SYS_process_vm_readv, SYS_process_vm_writev,
+			SYS_mount, SYS_umount2, SYS_pivot_root, SYS_chroot, SYS_unshare, SYS_setns,
+			SYS_bpf, SYS_perf_event_open, SYS_userfaultfd, SYS_io_uring_setup,
+			SYS_keyctl, SYS_add_key, SYS_request_key,
+			SYS_init_module, SYS_finit_module, SYS_delete_module, SYS_kexec_load, SYS_reboot,
+			SYS_open_by_handle_at, SYS_name_to_handle_at,
+			SYS_shmget, SYS_shmctl, SYS_msgget, SYS_semget,
+			SYS_tkill, SYS_pidfd_open, SYS_pidfd_send_signal, SYS_pidfd_getfd,
+			SYS_kcmp, SYS_process_madvise, SYS_process_mrelease
+		}) {
+			jump(BPF_JMP | BPF_JEQ | BPF_K, nr, 0, 1);
+			statement(BPF_RET | BPF_K, fail);
+		}
+
+		// glibc falls back to clone() when clone3() is missing, and clone()
+		// flags can be checked.
+		jump(BPF_JMP | BPF_JEQ | BPF_K, SYS_clone3, 0, 1);
+		statement(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | ENOSYS);
+		jump(BPF_JMP | BPF_JEQ | BPF_K, SYS_clone, 0, 4);
+		load_arg0();
+		jump(BPF_JMP | BPF_JSET | BPF_K,
+			CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWUSER | CLONE_NEWPID | CLONE_NEWNET | CLONE_NEWCGROUP, 0, 1);
+		statement(BPF_RET | BPF_K, fail);
+		load_nr();
+
+		// Allows `nr` only with a first argument among `values`.
+		const auto restrict_arg0 = [&](const long nr, const std::initializer_list<FilterValue> values) {
+			const uint8_t count = values.size();
+			jump(BPF_JMP | BPF_JEQ | BPF_K, nr, 0, count + 3);
+			load_arg0();
+			uint8_t remaining = count;
+			for (const auto value : values) {
+				filter_values.emplace_back(filter.size(), value);
+				jump(BPF_JMP | BPF_JEQ | BPF_K, 0, remaining--, 0);
+			}
+			statement(BPF_RET | BPF_K, fail);
+			statement(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+			load_nr();
+		};
+		if (hosted) {
+			jump(BPF_JMP | BPF_JEQ | BPF_K, SYS_shmat, 0, 1);
+			statement(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF);
+		}
+		else {
+			restrict_arg0(SYS_shmat, {channel_shmid, replay_shmid});
+		}
+		restrict_arg0(SYS_tgkill, {own_pid});
+		restrict_arg0(SYS_kill, {own_pid});
+		restrict_arg0(SYS_rt_sigqueueinfo, {own_pid});
+		restrict_arg0(SYS_rt_tgsigqueueinfo, {own_pid});
+
+		// Allows `nr` only with argument `arg` naming the strategy itself, as
+		// 0 or its pid, and, if `which` is given, with it as first argument.
+		const auto restrict_pid = [&](const long nr, const int arg, const long which = -1) {
+			const uint8_t checks = which >= 0 ? 2 : 0;
+			jump(BPF_JMP | BPF_JEQ | BPF_K, nr, 0, checks + 5);
+			if (which >= 0) {
+				load_arg0();
+				jump(BPF_JMP | BPF_JEQ | BPF_K, which, 0, 3);
+			}
+			load_arg(arg);
+			jump(BPF_JMP | BPF_JEQ | BPF_K, 0, 2, 0);
+			filter_values.emplace_back(filter.size(), own_pid);
+			jump(BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0);
+			statement(BPF_RET | BPF_K, fail);
+			statement(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+			load_nr();
+		};
+		for (const long nr : {
+			SYS_prlimit64, SYS_sched_setaffinity, SYS_sched_setscheduler, SYS_sched_setparam,
+			SYS_sched_setattr, SYS_migrate_pages, SYS_move_pages
+		}) {
+			restrict_pid(nr, 0);
+		}
+		restrict_pid(SYS_setpriority, 1, PRIO_PROCESS);
+		restrict_pid(SYS_ioprio_set, 1, __ioprio_who_process);
+
+		statement(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+		return result;
+	}
+
+	// Runs in the holder: finishes the namespaces once the judge has written
+	// the id maps, then stays around to keep them alive. `hosts` is mounted
+	// like the strategies, unless it is null.
+	[[noreturn]] static void hold(
+		const int control, const char* rootfs, const char* strategies, const char* target,
+		const char* hosts, const char* hosts_target
+	) {
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		char status = 1;
+		if (unshare(CLONE_NEWUSER | CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWNET) == -1 ||
+			write(control, &status, 1) != 1 || read(control, &status, 1) != 1) {
+			_exit(1);
+		}
+
+		// A read-only remount must keep the flags locked by the original mount.
+		const auto remount_read_only = [](const char* path) {
+			struct statvfs stat;
+			if (statvfs(path, &stat) == -1) {
+				return false;
+			}
+			unsigned long flags = MS_REMOUNT | MS_BIND | MS_RDONLY;
+			if (stat.f_flag & ST_NOSUID) flags |= MS_NOSUID;
+			if (stat.f_flag & ST_NODEV) flags |= MS_NODEV;
+			if (stat.f_flag & ST_NOEXEC) flags |= MS_NOEXEC;
+			if (stat.f_flag & ST_NOATIME) flags |= MS_NOATIME;
+			if (stat.f_flag & ST_NODIRATIME) flags |= MS_NODIRATIME;
+			if (stat.f_flag & ST_RELATIME) flags |= MS_RELATIME;
+			return mount(nullptr, path, nullptr, flags, nullptr) == 0;
+		};
+
+		const bool ready = (
+			sethostname(__sandbox_hostname, strlen(__sandbox_hostname)) == 0 &&
+			mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) == 0 &&
+			mount(rootfs, rootfs, nullptr, MS_BIND | MS_REC, nullptr) == 0 &&
+			mount(strategies, target, nullptr, MS_BIND | MS_REC, nullptr) == 0 &&
+			remount_read_only(target) &&
+			(!hosts || (mount(hosts, hosts_target, nullptr, MS_BIND | MS_REC, nullptr) == 0 && remount_read_only(hosts_target))) &&
+			remount_read_only(rootfs) &&
+			chdir(rootfs) == 0 &&
+			syscall(SYS_pivot_root, ".", ".") == 0 &&
+			umount2(".", MNT_DETACH) == 0 &&
+			chdir("/") == 0
+		);
+		status = ready ? 0 : 1;
+		if (write(control, &status, 1) != 1 || !ready) {
+			_exit(1);
+		}
+		for (;;) {
+			pause();
+		}
+	}
+
+	void create_namespaces(const std::filesystem::path& sandbox_directory, const std::filesystem::path& strategies_directory) {
+		const auto target = sandbox_directory / strategies_directory.relative_path();
+		std::filesystem::create_directories(target);
+		host_directory = std::filesystem::current_path();
+		const auto hosts = host_directory / "hosts";
+		const auto hosts_target = sandbox_directory / hosts.relative_path();
+		const bool mount_hosts = std::filesystem::is_directory(hosts);
+		if (mount_hosts) {
+			std::filesystem::create_directories(hosts_target);
+		}
+
+		int control[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, control) == -1) {
+			throw std::runtime_error("Failed to create socketpair!");
+		}
+		holder = fork();
+		if (holder == 0) {
+			::close(control[0]);
+			hold(
+				control[1], sandbox_directory.c_str(), strategies_directory.c_str(), target.c_str(),
+				mount_hosts ? hosts.c_str() : nullptr, hosts_target.c_str()
+			);
+		}
+		::close(control[1]);
+		if (holder < 0) {
+			::close(control[0]);
+			throw std::runtime_error("Failed to fork!");
+		}
+
+		char status = 1;
+		bool ready = read(control[0], &status, 1) == 1;
+		if (ready) {
+			// Only a privileged judge may map the sandbox user to another user.
+			const auto process = "/proc/" + std::to_string(holder);
+			const bool privileged = geteuid() == 0;
+			const auto uid = std::to_string(privileged ? __sandbox_uid : geteuid());
+			const auto gid = std::to_string(privileged ? __sandbox_gid : getegid());
+			ready = (
+				(privileged || write_text((process + "/setgroups").c_str(), "deny")) &&
+				write_text((process + "/uid_map").c_str(), (std::to_string(__sandbox_uid) + ' ' + uid + " 1").c_str()) &&
+				write_text((process + "/gid_map").c_str(), (std::to_string(__sandbox_gid) + ' ' + gid + " 1").c_str()) &&
+				write(control[0], &status, 1) == 1 &&
+				read(control[0], &status, 1) == 1 && status == 0
+			);
+		}
+		::close(control[0]);
+		if (!ready) {
+			throw std::runtime_error("Failed to create sandbox namespaces!");
+		}
+
+		const auto open_namespace = [&](const char* name) {
+			const auto path = "/proc/" + std::to_string(holder) + "/ns/" + name;
+			const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd == -1) {
+				throw std::runtime_error("Failed to open namespace: " + path);
+			}
+			return fd;
+		};
+		user_fd = open_namespace("user");
+		mount_fd = open_namespace("mnt");
+		uts_fd = open_namespace("uts");
+		network_fd = open_namespace("net");
+	}
+
+	void destroy() {
+		for (const int fd : {user_fd, mount_fd, uts_fd, network_fd}) {
+			if (fd != -1) {
+				::close(fd);
+			}
+		}
+		if (holder > 0) {
+			kill(holder, SIGKILL);
+			waitpid(holder, nullptr, 0);
+		}
+		for (const auto& slot : slots) {
+			if (slot.fd != -1) {
+				::close(slot.fd);
+			}
+			write_text((slot.path / "cgroup.kill").c_str(), "1");
+			rmdir(slot.path.c_str());
+		}
+	}
+
+	// Runs in the cloned child, which must not allocate: the judge may have
+	// other threads. Joins the sandbox as its user and patches `child_filter`
+	// (the child's own copy), which the caller then installs before exec.
+	bool enter(Filter& child_filter, const char* directory, const int shmid, const int replay, const int cpu) {
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		pin_to_cpu(0, cpu);
+
+		for (const auto& [index, value] : child_filter.values) {
+			child_filter.program[index].k = value == own_pid ? getpid() : value == channel_shmid ? shmid : replay;
+		}
+
+		// Joining the user namespace grants the capabilities the others need.
+		// They are lost again at exec, since the sandbox user is not root.
+		if (setns(user_fd, CLONE_NEWUSER) == -1 ||
+			setns(mount_fd, CLONE_NEWNS) == -1 ||
+			setns(uts_fd, CLONE_NEWUTS) == -1 ||
+			setns(network_fd, CLONE_NEWNET) == -1 ||
+			chdir(directory) == -1) {
+			return false;
+		}
+		setgroups(0, nullptr); // refused, and unneeded, when setgroups is denied
+		return (
+			setresgid(__sandbox_gid, __sandbox_gid, __sandbox_gid) == 0 &&
+			setresuid(__sandbox_uid, __sandbox_uid, __sandbox_uid) == 0 &&
+			prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0
+		);
+	}
+
+	pid_t clone_into(const int slot) {
+		clone_args args = {};
+		args.flags = CLONE_INTO_CGROUP;
+		args.exit_signal = SIGCHLD;
+		args.cgroup = slots.at(slot).fd;
+
+		const pid_t pid = syscall(SYS_clone3, &args, sizeof(args));
+		if (pid < 0) {
+			throw std::runtime_error("Failed to clone3!");
+		}
+		return pid;
+	}
+
+	static bool send_fd(const int socket, const int fd) {
+		char byte = 0;
+		iovec data = { &byte, 1 };
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+		msghdr message = {};
+		message.msg_iov = &data;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		const auto header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(header), &fd, sizeof(int));
+		return sendmsg(socket, &message, MSG_NOSIGNAL) == 1;
+	}
+
+	static int receive_fd(const int socket) {
+		char byte;
+		iovec data = { &byte, 1 };
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+		msghdr message = {};
+		message.msg_iov = &data;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		if (recvmsg(socket, &message, MSG_CMSG_CLOEXEC) != 1) {
+			return -1;
+		}
+		const auto header = CMSG_FIRSTHDR(&message);
+		if (!header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+			return -1;
+		}
+		int fd;
+		memcpy(&fd, CMSG_DATA(header), sizeof(int));
+		return fd;
+	}
+
+public:
+	SandboxManager(
+		const std::filesystem::path& sandbox_directory,
+		const std::filesystem::path& strategies_directory,
+		const SandboxOptions& _options = {}
+	): options(_options) {
+		if (__sandbox_audit_arch == 0) {
+			throw std::runtime_error("Failed to create sandbox: unsupported architecture!");
+		}
+		try {
+			strategy_filter = build_filter(false);
+			host_filter = build_filter(true);
+			create_slots();
+			create_namespaces(sandbox_directory, strategies_directory);
+		} catch (...) {
+			destroy();
+			throw;
+		}
+	}
+
+	SandboxManager(const SandboxManager&) = delete;
+	SandboxManager& operator=(const SandboxManager&) = delete;
+
+	~SandboxManager() {
+		destroy();
+	}
+
+	// Starts `path` in `slot` with the channel `shmid` as its argument, as a
+	// child of the calling process.
+	pid_t spawn(const int slot, const char* path, const int shmid, const int replay_shmid, const int cpu) {
+		const pid_t pid = clone_into(slot);
+		if (pid == 0) {
+			char shmid_argument[16];
+			snprintf(shmid_argument, sizeof(shmid_argument), "%d", shmid);
+			const sock_fprog program = { (unsigned short)strategy_filter.program.size(), strategy_filter.program.data() };
+			if (enter(strategy_filter, "/", shmid, replay_shmid, cpu) &&
+				prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &program) == 0) {
+				execl(path, path, shmid_argument, nullptr);
+			}
+			_exit(-1);
+		}
+		return pid;
+	}
+
+	// A fresh slot, with the host limits, for one interpreter host.
+	int add_host_slot() {
+		return create_slot(options.host_memory_limit, options.host_pids_limit);
+	}
+
+	// Kills whatever is left in `slot`, e.g. processes forked by a strategy
+	// of a stopped host.
+	void clear_slot(const int slot) {
+		write_text((slots.at(slot).path / "cgroup.kill").c_str(), "1");
+	}
+
+	// Starts the interpreter host `argv` in `slot`, from the judge's working
+	// directory and with `control` as its stdin and stdout. Returns its pid,
+	// and in `listener` the fd its shmat() calls arrive on.
+	pid_t spawn_host(const int slot, char* const* argv, const int control, int& listener) {
+		int notify[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, notify) == -1) {
+			throw std::runtime_error("Failed to create socketpair!");
+		}
+
+		pid_t pid;
+		try {
+			pid = clone_into(slot);
+		} catch (...) {
+			::close(notify[0]);
+			::close(notify[1]);
+			throw;
+		}
+		if (pid == 0) {
+			const sock_fprog program = { (unsigned short)host_filter.program.size(), host_filter.program.data() };
+			if (dup2(control, 0) == -1 || dup2(control, 1) == -1 ||
+				!enter(host_filter, host_directory.c_str(), -1, -1, -1)) {
+				_exit(-1);
+			}
+			const int notifications = syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_NEW_LISTENER, &program);
+			if (notifications == -1 || !send_fd(notify[1], notifications)) {
+				_exit(-1);
+			}
+			::close(notifications); // the host must not answer for itself
+			execvp(argv[0], argv);
+			_exit(-1); // execvp failed
+		}
+
+		::close(notify[1]);
+		listener = receive_fd(notify[0]);
+		::close(notify[0]);
+		if (listener == -1) {
+			kill(pid, SIGKILL);
+			waitpid(pid, nullptr, 0);
+			throw std::runtime_error("Failed to start sandboxed interpreter host!");
+		}
+		return pid;
+	}
+
+	// Answers the shmat() calls waiting on `listener` without blocking: the
+	// segments `shmid` and `replay_shmid` may be attached, any other fails
+	// with EPERM. shmat() takes no pointer that could change meanwhile, so
+	// the kernel may carry on with the checked call.
+	static void allow_attachments(const int listener, const int shmid, const int replay_shmid) {
+		pollfd fd = { listener, POLLIN, 0 };
+		while (poll(&fd, 1, 0) == 1 && (fd.revents & POLLIN)) {
+			seccomp_notif request = {};
+			if (ioctl(listener, SECCOMP_IOCTL_NOTIF_RECV, &request) == -1) {
+				return; // the caller was killed meanwhile, or the host is gone
+			}
+			const int segment = request.data.args[0];
+			seccomp_notif_resp response = {};
+			response.id = request.id;
+			if (segment == shmid || (replay_shmid != -1 && segment == replay_shmid)) {
+				response.flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+			}
+			else {
+				response.error = -EPERM;
+			}
+			ioctl(listener, SECCOMP_IOCTL_NOTIF_SEND, &response);
+		}
+	}
+};
@@ -1,39 +1,142 @@
+#pragma once
 #include <stdexcept>
 #include <string>
+#include <chrono>
+#include <cstdint>
 #include <cstring>
+#include <cstddef>
+#include <cstdio>
+#include <algorithm>
+#include <vector>
 #include <unistd.h>
 #include <signal.h>
 #include <wait.h>
 #include <sys/ipc.h>
+#include <sys/prctl.h>
 #include <sys/shm.h>
-#define __WAIT__(cond) { do { __asm__ __volatile__(""); } while(!(cond)); }
+#include "interpreter-host.h"
+#include "placement.h"
+#include "sandbox-manager.h"
+#define __LOAD__(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define __STORE__(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
 
-constexpr int __initial_key = 998244353;
-constexpr int __counter_limit = 16;
+constexpr int __handshake_timeout = 5000; // ms
+constexpr int __move_timeout = 30000;     // ms, generous enough for a long replay
 
-struct SharedData {
-	int output_remain;
-	int output_value;
-	int input_remain;
-	int input_value;
+constexpr uint32_t __channel_magic = 0x43445049; // "IPDC"
+constexpr uint32_t __channel_layout_version = 3;
+constexpr int __channel_error = -2; // lost or duplicated handoff, or a dead strategy
+
+// Channel layout, version 3. Strategy harnesses (strategy_examples/,
+// hosts/) mirror it and must bump the version together with this struct.
+//
+// The judge fills in the header before the strategy starts. The harness
+// validates magic, version and size, then acknowledges with
+// magic ^ (its own layout version) in harness_ack. Harnesses of the first,
+// headerless layout only ever wrote the first 16 bytes, so the ack lives
+// past them and cannot be mistaken for one of their moves. Each direction
+// lives on its own cache line.
+// Its sequence number counts the messages sent so far, so a reader that
+// sees anything but its last sequence + 1 has lost or duplicated a handoff.
+//
+// To resume a match, the judge points replay_shmid at a ReplaySegment of
+// replay_rounds rounds. A harness that advertises __harness_feature_replay
+// feeds those rounds to the strategy without touching the channel, checks
+// that the strategy repeats its recorded moves, and sets replay_status
+// before its first live message.
+struct ChannelHeader {
+	uint32_t magic;
+	uint32_t layout_version;
+	uint32_t size;
+	uint32_t reserved; // written by first-layout harnesses; never read
+	uint32_t harness_features;
+	int32_t replay_shmid;
+	uint32_t replay_rounds;
+	uint32_t replay_status;
+	uint32_t harness_ack;
 };
 
-class SandboxedProcess {
-public:
-	int pid;
-	int shmid;
-	SharedData* addr;
+constexpr uint32_t __harness_feature_replay = 1;
 
-	SandboxedProcess(const std::string& command) {
-		const auto execution_command = command;
+enum ReplayStatus : uint32_t {
+	replay_none = 0,
+	replay_done = 1,
+	replay_diverged = 2
+};
+
+struct ReplayFeed {
+	int shmid = -1;
+	uint32_t rounds = 0;
+};
 
-		static int counter = 0;
-		const key_t key = __initial_key + counter++;
-		if (counter >= __counter_limit) {
-			counter -= __counter_limit;
+// Recorded rounds for one strategy: `rounds` bytes of its own moves
+// followed by `rounds` bytes of its opponent's moves.
+class ReplaySegment {
+	int shmid = -1;
+	uint32_t rounds = 0;
+
+public:
+	template<class Choice>
+	ReplaySegment(const std::vector<Choice>& own, const std::vector<Choice>& opponent, const uint32_t _rounds):
+		rounds(_rounds)
+	{
+		shmid = shmget(IPC_PRIVATE, std::max<size_t>(2 * rounds, 1), IPC_CREAT | 0666);
+		if (shmid == -1) {
+			throw std::runtime_error("Failed to shmget!");
+		}
+
+		const auto addr = (int8_t*)shmat(shmid, nullptr, 0);
+		if (addr == (void*)-1) {
+			shmctl(shmid, IPC_RMID, 0);
+			throw std::runtime_error("Failed to shmat!");
+		}
+		for (uint32_t round = 0; round < rounds; round++) {
+			addr[round] = own[round];
+			addr[rounds + round] = opponent[round];
 		}
+		shmdt(addr);
+	}
+
+	ReplaySegment(const ReplaySegment&) = delete;
+	ReplaySegment& operator=(const ReplaySegment&) = delete;
+
+	~ReplaySegment() {
+		shmctl(shmid, IPC_RMID, 0);
+	}
 
-		shmid = shmget(key, sizeof(SharedData), IPC_CREAT | 0666);
+	ReplayFeed feed() const {
+		return { shmid, rounds };
+	}
+};
+
+struct alignas(64) ChannelSlot {
+	uint32_t sequence;
+	int32_t value;
+};
+
+struct SharedData {
+	alignas(64) ChannelHeader header;
+	ChannelSlot to_strategy;
+	ChannelSlot to_judge;
+};
+
+static_assert(offsetof(SharedData, to_strategy) == 64);
+static_assert(offsetof(SharedData, to_judge) == 128);
+static_assert(offsetof(ChannelHeader, harness_ack) >= 16);
+static_assert(sizeof(ChannelHeader) <= 64);
+static_assert(sizeof(SharedData) == 192);
+
+class SandboxedProcess {
+	InterpreterHost* host = nullptr;
+	bool closed = false;
+	bool exited = false;
+	uint32_t sent = 0;
+	uint32_t received = 0;
+
+	void attach(const int node, const ReplayFeed& replay) {
+		// Harnesses are handed the shmid, so the segment needs no key, and
+		// concurrent judges never share one.
+		shmid = shmget(IPC_PRIVATE, sizeof(SharedData), IPC_CREAT | 0666);
 		if (shmid == -1) {
 			throw std::runtime_error("Failed to shmget!");
 		}
@@ -42,11 +145,84 @@ public:
 		if (addr == (void*)-1) {
 			throw std::runtime_error("Failed to shmat!");
 		}
+		prefer_node(addr, sizeof(SharedData), node);
 		memset(addr, 0, sizeof(SharedData));
+		addr->header.magic = __channel_magic;
+		addr->header.layout_version = __channel_layout_version;
+		addr->header.size = sizeof(SharedData);
+		addr->header.replay_shmid = replay.shmid;
+		addr->header.replay_rounds = replay.rounds;
+	}
+
+	void release() {
+		if (host) {
+			host->busy = false;
+			host = nullptr;
+		}
+		else if (!exited) {
+			kill(pid, SIGKILL);
+			waitpid(pid, nullptr, 0); // a zombie still counts against pids.max
+		}
+		shmdt(addr);
+		shmctl(shmid, IPC_RMID, 0);
+		closed = true;
+	}
+
+public:
+	int pid;
+	int shmid;
+	SharedData* addr;
+
+	// Commands whose runtime has an interpreter host in `hosts` are served by
+	// a pooled host instead of a fresh interpreter per match.
+	// The process is pinned to `cpu` and its channel placed on `node` (-1: anywhere).
+	// A non-empty `replay` asks the harness to fast-forward through recorded rounds.
+	// Other commands are started in `sandbox_slot` of `sandbox`, if given;
+	// `hosts` must then start its hosts in the same sandbox.
+	SandboxedProcess(
+		const ExecCommand& command,
+		InterpreterHostPool* hosts = nullptr,
+		const int cpu = -1,
+		const int node = -1,
+		const ReplayFeed& replay = {},
+		SandboxManager* sandbox = nullptr,
+		const int sandbox_slot = 0
+	) {
+		attach(node, replay);
+
+		if (hosts) {
+			if ((host = hosts->acquire(command.runtime))) {
+				try {
+					host->begin(command.module, shmid, replay.shmid);
+				} catch (...) {
+					release();
+					throw;
+				}
+				pid = host->get_pid();
+				host->pin(cpu);
+				return;
+			}
+		}
+
+		if (sandbox) {
+			try {
+				pid = sandbox->spawn(sandbox_slot, command.command.c_str(), shmid, replay.shmid, cpu);
+			} catch (...) {
+				exited = true;
+				release();
+				throw;
+			}
+			return;
+		}
 
 		pid = fork();
 		if (pid == 0) {
-			execl(execution_command.data(), execution_command.data(), std::to_string(shmid).data(), nullptr);
+			prctl(PR_SET_PDEATHSIG, SIGKILL); // don't outlive a killed judge
+			pin_to_cpu(0, cpu);
+			char shmid_argument[16]; // no allocation between fork and exec
+			snprintf(shmid_argument, sizeof(shmid_argument), "%d", shmid);
+			const auto path = command.command.data();
+			execl(path, path, shmid_argument, nullptr);
 			exit(-1); // execl failed
 		}
 		else if (pid < 0) {
@@ -54,38 +230,87 @@ public:
 		}
 	}
 
+	SandboxedProcess(const SandboxedProcess&) = delete;
+	SandboxedProcess& operator=(const SandboxedProcess&) = delete;
+
+	// An unfinished match (e.g. an invalid choice) leaves the strategy
+	// spinning, so its host is recycled instead of waited for.
+	~SandboxedProcess() {
+		if (!closed) {
+			if (host) {
+				host->stop();
+			}
+			release();
+		}
+	}
+
 	bool close() {
 		// int status;
 		// waitpid(pid, &status, 0);
-		kill(pid, SIGKILL);
-		shmdt(addr);
-		shmctl(shmid, IPC_RMID, 0);
-		return false;
+		bool failed = false;
+		if (host) {
+			failed = !host->finish();
+		}
+		release();
+		return failed;
+	}
+
+	bool running() {
+		if (host) {
+			return host->running();
+		}
+		if (!exited && waitpid(pid, nullptr, WNOHANG) != 0) {
+			exited = true;
+		}
+		return !exited;
+	}
+
+	// Waits for the strategy harness to acknowledge the channel layout.
+	// Fails on a layout mismatch, or if the strategy dies or never attaches.
+	bool handshake() {
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(__handshake_timeout);
+		for (int spin = 0;; spin++) {
+			if (const auto ack = __LOAD__(addr->header.harness_ack)) {
+				return ack == (__channel_magic ^ __channel_layout_version);
+			}
+			if (spin % 1024 == 0 && (!running() || std::chrono::steady_clock::now() > deadline)) {
+				return false;
+			}
+		}
 	}
 
+	bool supports_replay() const {
+		return __LOAD__(addr->header.harness_features) & __harness_feature_replay;
+	}
+
+	// Valid once the first live message has been received.
+	ReplayStatus replay_status() const {
+		return (ReplayStatus)__LOAD__(addr->header.replay_status);
+	}
+
+	// Whether recv_int() would return without waiting.
+	bool ready() const {
+		return __LOAD__(addr->to_judge.sequence) != received;
+	}
+
+	// Fails if the strategy dies or takes longer than __move_timeout.
 	int recv_int() {
-		__WAIT__(addr->input_remain);
-		addr->input_remain = 0;
-		return addr->input_value;
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(__move_timeout);
+		uint32_t sequence;
+		for (int spin = 1; (sequence = __LOAD__(addr->to_judge.sequence)) == received; spin++) {
+			if (spin % 65536 == 0 && (!running() || std::chrono::steady_clock::now() > deadline)) {
+				return __channel_error;
+			}
+		}
+		if (sequence != received + 1) {
+			return __channel_error;
+		}
+		received = sequence;
+		return addr->to_judge.value;
 	}
 
 	void send_int(const int value) {
-		addr->output_value = value;
-		addr->output_remain = 1;
+		addr->to_strategy.value = value;
+		__STORE__(addr->to_strategy.sequence, ++sent);
 	}
 };
-
-/*
-const std::string sandbox_command = (
-	"nsjail -Mo" // or --really_quiet
-	" --user 12345 --group 12345 --hostname playground"
-	// " --stderr_to_null --disable_proc --quiet"
-	" --seccomp_string 'ALLOW { write { fd == 1 } } DEFAULT ALLOW'"
-	" --max_cpus 1"
-	" --time_limit " + std::to_string(time_limit) +
-	" --rlimit_as " + std::to_string(memory_limit) +
-	" --bindmount_ro " + strategies_directory.string() +
-	" --chroot " + sandbox_directory.string() +
-	" -- "
-);
-*/
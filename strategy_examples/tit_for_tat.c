@@ -10,31 +10,88 @@ void __main__() {
 	}
 }
 
+#include <stdint.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
-#define __WAIT__(cond) { do { __asm__ __volatile__(""); } while(!(cond)); }
+#define __LOAD__(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define __STORE__(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+/* Must match SharedData in sandboxed-process.h. */
+#define CHANNEL_MAGIC 0x43445049
+#define CHANNEL_LAYOUT_VERSION 3
+#define LOST_HANDOFF -2
+#define HARNESS_FEATURE_REPLAY 1
+#define REPLAY_DONE 1
+#define REPLAY_DIVERGED 2
+
+struct ChannelSlot {
+	uint32_t sequence;
+	int32_t value;
+} __attribute__((aligned(64)));
 
 struct SharedData {
-	int input_remain;
-	int input_value;
-	int output_remain;
-	int output_value;
+	struct {
+		uint32_t magic;
+		uint32_t layout_version;
+		uint32_t size;
+		uint32_t reserved;
+		uint32_t harness_features;
+		int32_t replay_shmid;
+		uint32_t replay_rounds;
+		uint32_t replay_status;
+		uint32_t harness_ack;
+	} header __attribute__((aligned(64)));
+	struct ChannelSlot to_strategy;
+	struct ChannelSlot to_judge;
 }* addr;
 
+uint32_t received, sent;
+
+/* Recorded rounds to fast-forward through when resuming a match. */
+int8_t* replay;
+uint32_t replay_rounds, replay_round, replay_diverged;
+
 int input() {
-	__WAIT__(addr->input_remain);
-	addr->input_remain = 0;
-	return addr->input_value;
+	if (replay_round < replay_rounds) {
+		return replay[replay_rounds + replay_round++];
+	}
+	uint32_t sequence;
+	while ((sequence = __LOAD__(addr->to_strategy.sequence)) == received) {
+		__asm__ __volatile__("" ::: "memory");
+	}
+	if (sequence != received + 1) return LOST_HANDOFF;
+	received = sequence;
+	return addr->to_strategy.value;
 }
 
 void output(const int value) {
-	addr->output_value = value;
-	addr->output_remain = 1;
+	if (replay_round < replay_rounds) {
+		replay_diverged |= value != replay[replay_round];
+		return;
+	}
+	if (replay && sent == 0) {
+		addr->header.replay_status = replay_diverged ? REPLAY_DIVERGED : REPLAY_DONE;
+	}
+	addr->to_judge.value = value;
+	__STORE__(addr->to_judge.sequence, ++sent);
 }
 
 int main(int argc, char* argv[]) {
 	const int shmid = atoi(argv[1]);
 	addr = shmat(shmid, (void*)0, 0);
-	__main__();
+	const int valid = (
+		addr->header.magic == CHANNEL_MAGIC &&
+		addr->header.layout_version == CHANNEL_LAYOUT_VERSION &&
+		addr->header.size == sizeof(struct SharedData)
+	);
+	if (valid && addr->header.replay_rounds > 0) {
+		replay = shmat(addr->header.replay_shmid, (void*)0, SHM_RDONLY);
+		if (replay == (void*)-1) return 1;
+		replay_rounds = addr->header.replay_rounds;
+	}
+	addr->header.harness_features = HARNESS_FEATURE_REPLAY;
+	__STORE__(addr->header.harness_ack, CHANNEL_MAGIC ^ CHANNEL_LAYOUT_VERSION);
+	if (valid) __main__();
+	if (replay) shmdt(replay);
 	shmdt(addr);
 }
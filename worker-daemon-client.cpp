@@ -0,0 +1,81 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "daemon-client.h"
+
+// Usage:
+//   worker-daemon-client <socket> [--bulk] compile <name> <lang> <file>
+//   worker-daemon-client <socket> [--bulk] match <name> <name> [iter_min iter_max]
+//   worker-daemon-client <socket> [--bulk] tournament <name>...
+//   worker-daemon-client <socket> report
+int main(const int argc, const char* argv[]) {
+	std::ios_base::sync_with_stdio(false);
+
+	std::vector<std::string> args(argv + 1, argv + argc);
+	if (args.size() < 2) {
+		std::cout << "Usage: " << argv[0] << " <socket> [--bulk] compile|match|tournament|report ..." << std::endl;
+		return 1;
+	}
+
+	const auto socket_path = args[0];
+	args.erase(args.begin());
+
+	auto priority = Priority::interactive;
+	if (args[0] == "--bulk") {
+		priority = Priority::bulk;
+		args.erase(args.begin());
+	}
+
+	try {
+		DaemonClient client(socket_path);
+		const auto& command = args.at(0);
+
+		if (command == "compile") {
+			std::ifstream file(args.at(3));
+			const std::string content(
+				(std::istreambuf_iterator<char>(file)),
+				(std::istreambuf_iterator<char>())
+			);
+			if (const auto execution_command = client.compile(args.at(1), args.at(2), content, priority)) {
+				std::cout << *execution_command << std::endl;
+			}
+			else {
+				std::cout << "Compilation error!" << std::endl;
+				return 1;
+			}
+		}
+		else if (command == "match") {
+			std::pair<int, int> iter_range = {200, 500};
+			if (args.size() >= 5) {
+				iter_range = {std::stoi(args[3]), std::stoi(args[4])};
+			}
+			if (const auto scores = client.match(args.at(1), args.at(2), iter_range, priority)) {
+				std::cout << scores->first << ' ' << scores->second << std::endl;
+			}
+			else {
+				std::cout << "Comparison error!" << std::endl;
+				return 1;
+			}
+		}
+		else if (command == "tournament") {
+			const std::vector<std::string> names(args.begin() + 1, args.end());
+			const auto standings = client.tournament(names, {200, 500}, priority, [](const uint32_t done, const uint32_t total) {
+				std::cout << "DEBUG: " << done << '/' << total << std::endl;
+			});
+			for (size_t index = 0; index < names.size(); index++) {
+				std::cout << names[index] << ' ' << standings[index].first << ' ' << standings[index].second << std::endl;
+			}
+		}
+		else if (command == "report") {
+			std::cout << client.report(priority);
+		}
+		else {
+			std::cout << "Unknown command: " << command << std::endl;
+			return 1;
+		}
+	} catch(const std::exception& err) {
+		std::cout << "Runtime error: " << err.what() << std::endl;
+		return 1;
+	}
+}
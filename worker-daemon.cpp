@@ -0,0 +1,39 @@
+#include <iostream>
+#include <string>
+#include <signal.h>
+#include "judge-daemon.h"
+
+JudgeDaemon* daemon_instance = nullptr;
+
+void handle_signal(int) {
+	if (daemon_instance) {
+		daemon_instance->stop();
+	}
+}
+
+// Usage: worker-daemon [socket] [sandbox [cgroup2 mount point]]
+int main(const int argc, const char* argv[]) {
+	std::ios_base::sync_with_stdio(false);
+
+	const std::string socket_path = argc > 1 ? argv[1] : "worker-ipd.sock";
+
+	try {
+		JudgeDaemon daemon(socket_path);
+		if (argc > 2 && std::string(argv[2]) == "sandbox") {
+			SandboxOptions options;
+			if (argc > 3) {
+				options.cgroup_root = argv[3];
+			}
+			daemon.enable_sandbox(options);
+		}
+		daemon_instance = &daemon;
+		signal(SIGINT, handle_signal);
+		signal(SIGTERM, handle_signal);
+
+		std::cout << "DEBUG: Listening on " << socket_path << std::endl;
+		daemon.serve();
+		daemon_instance = nullptr;
+	} catch(const std::runtime_error& err) {
+		std::cout << "Runtime error: " << err.what() << std::endl;
+	}
+}